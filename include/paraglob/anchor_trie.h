@@ -0,0 +1,89 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+//
+// A trie of literals anchored at the start or the end of a text.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace paraglob {
+
+/* Maps literals to the patterns that have to begin (or end) with them. A
+   query walks the trie along the text from its anchored end, so it only
+   visits literals that actually line up with that end, no matter how often
+   they occur elsewhere in the text. */
+class AnchorTrie {
+public:
+    enum class Anchor { Start, End };
+
+    explicit AnchorTrie(Anchor anchor) : anchor(anchor), nodes(1) {}
+
+    /* Register a pattern that is anchored with the given literal */
+    void insert(std::string_view literal, uint32_t pattern) {
+        uint32_t node = 0;
+        for ( size_t i = 0; i < literal.size(); i++ ) {
+            uint8_t byte = this->byte_at(literal, i);
+            std::vector<Edge>& edges = this->nodes[node].edges;
+            auto edge = std::lower_bound(edges.begin(), edges.end(), byte);
+
+            if ( edge == edges.end() || edge->byte != byte ) {
+                uint32_t child = this->nodes.size();
+                edge = edges.insert(edge, {byte, child});
+                this->nodes.emplace_back();
+            }
+
+            node = edge->node;
+        }
+
+        this->nodes[node].patterns.push_back(pattern);
+    }
+
+    /* Call f(pattern) for every pattern whose literal begins (or ends) the
+       text, shortest literals first. */
+    template<typename F>
+    void find(std::string_view text, F&& f) const {
+        uint32_t node = 0;
+        for ( size_t i = 0;; i++ ) {
+            for ( uint32_t pattern : this->nodes[node].patterns )
+                f(pattern);
+
+            if ( i == text.size() )
+                return;
+
+            uint8_t byte = this->byte_at(text, i);
+            const std::vector<Edge>& edges = this->nodes[node].edges;
+            auto edge = std::lower_bound(edges.begin(), edges.end(), byte);
+
+            if ( edge == edges.end() || edge->byte != byte )
+                return;
+
+            node = edge->node;
+        }
+    }
+
+private:
+    struct Edge {
+        uint8_t byte;
+        uint32_t node;
+
+        bool operator<(uint8_t other) const { return byte < other; }
+    };
+
+    struct Node {
+        std::vector<Edge> edges; // Sorted by byte
+        std::vector<uint32_t> patterns;
+    };
+
+    // The i-th byte counted from the anchored end
+    uint8_t byte_at(std::string_view s, size_t i) const {
+        return static_cast<uint8_t>(this->anchor == Anchor::Start ? s[i] : s[s.size() - 1 - i]);
+    }
+
+    Anchor anchor;
+    std::vector<Node> nodes;
+};
+
+} // namespace paraglob
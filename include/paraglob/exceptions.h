@@ -17,6 +17,11 @@ struct overflow_error : public std::overflow_error {
     using std::overflow_error::overflow_error;
 };
 
+/* Indicates serialized data in a format this version cannot read. */
+struct format_error : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
 /* Thrown when a paraglob fails to add a pattern. */
 struct add_error : public std::runtime_error {
     using std::runtime_error::runtime_error;
@@ -0,0 +1,128 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+//
+// A glob pattern compiled once for repeated matching.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace paraglob {
+
+/* A glob pattern compiled for repeated matching with the semantics of
+   fnmatch(pattern, text, 0) in the C locale. The pattern is split on '*'
+   into segments of single-character atoms. The first segment is anchored at
+   the start of the text, the last one at its end, and every segment in
+   between is placed at its leftmost occurrence after the previous one.
+   Since '*' can absorb anything, the leftmost placement is always a valid
+   choice, so matching never backtracks and takes O(text * pattern) time at
+   worst. Syntax this matcher does not model (collating symbols and
+   equivalence classes in brackets, unknown character classes) falls back to
+   fnmatch. */
+class Glob {
+public:
+    explicit Glob(std::string pattern);
+
+    const std::string& pattern() const { return this->source; }
+
+    /* Returns true if the whole text matches. fnmatch reads the text as a C
+       string, so callers must cut it at the first NUL to get the same
+       result. */
+    bool matches(std::string_view subject) const;
+
+    /* The maximal runs of literal characters in the pattern. Every text the
+       pattern matches contains all of them. Empty if the pattern is left to
+       fnmatch. */
+    std::vector<std::string> literals() const;
+
+    /* Bounds on the length of the texts the pattern can match. The maximum
+       is SIZE_MAX if the pattern has a '*'. */
+    size_t min_length() const;
+    size_t max_length() const;
+
+    /* The byte every matching text starts (or ends) with, or -1 if there is
+       no such byte. */
+    int first_byte() const;
+    int last_byte() const;
+
+    /* Whether the pattern is matched natively rather than by fnmatch. Only
+       then does it have the positions below. */
+    bool is_native() const { return ! this->use_fnmatch && ! this->never_matches; }
+
+    /* The pattern without its stars is a sequence of positions that each
+       match a single byte. */
+    size_t positions() const { return this->atoms.size(); }
+
+    /* Whether the byte can fill the position */
+    bool accepts(size_t position, uint8_t byte) const { return this->atom_matches(this->atoms[position], byte); }
+
+    /* Whether a '*' comes right before the position. The position after the
+       last one stands for the end of the pattern. */
+    bool star_before(size_t position) const;
+
+    /* The pattern is also a list of segments, the runs of positions between
+       its stars. These give access to them by index. */
+    size_t segment_count() const { return this->segments.size(); }
+    size_t segment_size(size_t segment) const { return this->segments[segment].size(); }
+
+    /* Identical for two segments exactly when they match the same texts */
+    std::string segment_key(size_t segment) const;
+
+    /* Whether the segment matches the subject at pos */
+    bool segment_at(size_t segment, std::string_view subject, size_t pos) const {
+        return this->segment_matches_at(this->segments[segment], subject, pos);
+    }
+
+    /* The leftmost position in [from, to - size] where the segment matches,
+       or std::string::npos */
+    size_t find_segment(size_t segment, std::string_view subject, size_t from, size_t to) const {
+        return this->find_segment(this->segments[segment], subject, from, to);
+    }
+
+private:
+    enum class AtomKind : uint8_t { Byte, Any, Set };
+
+    struct Atom {
+        AtomKind kind;
+        uint8_t byte;     // For AtomKind::Byte
+        uint16_t set;     // Index into sets for AtomKind::Set
+    };
+
+    // A run of atoms between two stars, given as a range into atoms
+    struct Segment {
+        uint32_t begin;
+        uint32_t end;
+
+        // Offsets of the first and the last literal byte within the segment,
+        // which are used to find where it may occur.
+        uint32_t first_literal = UINT32_MAX;
+        uint32_t last_literal = UINT32_MAX;
+
+        uint32_t size() const { return end - begin; }
+    };
+
+    using ByteSet = std::array<uint64_t, 4>;
+
+    enum class BracketResult { Parsed, Unterminated, Unsupported };
+
+    void compile();
+    BracketResult parse_bracket(size_t& pos);
+
+    bool atom_matches(const Atom& atom, uint8_t c) const;
+    bool segment_matches_at(const Segment& segment, std::string_view subject, size_t pos) const;
+    size_t find_segment(const Segment& segment, std::string_view subject, size_t from, size_t to) const;
+
+    std::string source;
+    std::vector<Atom> atoms;
+    std::vector<ByteSet> sets;
+    std::vector<Segment> segments;
+    bool has_star = false;
+    bool never_matches = false;
+    bool use_fnmatch = false;
+};
+
+} // namespace paraglob
@@ -4,43 +4,105 @@
 
 #pragma once
 
-#include <fnmatch.h>
-#include <algorithm> // copy_if
-#include <iterator>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "paraglob/glob.h"
+#include "paraglob/segment_trie.h"
+#include "paraglob/shift_and.h"
+
 namespace paraglob {
 
+/* A pattern to verify when a meta word is found, with the facts about it
+   that let a text be rejected without running the matcher */
+struct Candidate {
+    uint32_t pattern;
+    uint32_t min_length;
+    uint32_t max_length; // UINT32_MAX if the pattern has a '*'
+    int16_t first_byte;  // -1 unless every match starts with this byte
+    int16_t last_byte;   // -1 unless every match ends with this byte
+
+    bool admits(std::string_view text) const {
+        return text.size() >= min_length && text.size() <= max_length &&
+               (first_byte < 0 || static_cast<uint8_t>(text.front()) == first_byte) &&
+               (last_byte < 0 || static_cast<uint8_t>(text.back()) == last_byte);
+    }
+};
+
 class ParaglobNode {
 public:
-    ParaglobNode(std::string meta_word, std::string init_pattern)
-        : meta_word(std::move(meta_word)), patterns({std::move(init_pattern)}) {}
+    ParaglobNode(uint32_t id, std::string meta_word) : id(id), meta_word(std::move(meta_word)) {}
+
+    /* The id the automaton reports the meta word with */
+    uint32_t get_id() const { return id; }
 
     std::string get_meta_word() const { return meta_word; }
 
     bool operator==(const ParaglobNode& other) const { return meta_word == other.meta_word; }
 
-    void add_pattern(std::string pattern) { patterns.push_back(std::move(pattern)); }
+    /* Patterns are added one after the other, so a pattern that contains
+       this meta word more than once is only kept once. */
+    void add_pattern(const Candidate& candidate) {
+        if ( patterns.empty() || patterns.back().pattern != candidate.pattern )
+            patterns.push_back(candidate);
+    }
+
+    /* The patterns to consider when the meta word is found */
+    const std::vector<Candidate>& get_patterns() const { return patterns; }
 
-    /* Merges this nodes matching patterns into the input vector. */
-    void merge_matches(std::vector<std::string>& target, const std::string& text) const {
-        std::copy_if(patterns.begin(), patterns.end(), std::back_inserter(target),
-                     [text](const std::string& candidate) {
-                         return (fnmatch(candidate.c_str(), text.c_str(), 0) == 0);
-                     });
+    /* Patterns of the form '*word*' match whenever the meta word is found,
+       so they are kept apart and need no verification. */
+    void add_containing(uint32_t pattern) { containing.push_back(pattern); }
+
+    const std::vector<uint32_t>& get_containing() const { return containing; }
+
+    /* Patterns that need more than this meta word to be found before they
+       are verified stay in the list, so that the others still filter them.
+       The rest can be verified together as soon as the meta word is found:
+
+       Move the patterns with a '*' into a trie of their segments, so that
+       the segments they share are matched only once per text. This only
+       happens if they share enough for the trie to place at most half as
+       many segments as matching them one by one would. */
+    void share_patterns(const std::vector<std::unique_ptr<Glob>>& globs, const std::vector<uint32_t>& required) {
+        SegmentTrie trie;
+        std::vector<Candidate> rest;
+        for ( const Candidate& candidate : patterns )
+            if ( required[candidate.pattern] > 1 || ! trie.add(*globs[candidate.pattern], candidate.pattern) )
+                rest.push_back(candidate);
+
+        if ( trie.branches() * 2 > trie.placements() )
+            return;
+
+        segments = std::move(trie);
+        patterns = std::move(rest);
     }
 
-    // Merges this nodes patterns into the input vector
-    // Note: this could be done more efficiently with a move iterator if we wanted
-    // this to be destructive.
-    void merge_patterns(std::vector<std::string>& target) const {
-        target.insert(target.begin(), patterns.begin(), patterns.end());
+    const SegmentTrie& get_segments() const { return segments; }
+
+    /* Move the patterns that fit into one bit-parallel matcher, so that they
+       are all verified in a single pass over the text. */
+    void pack_patterns(const std::vector<std::unique_ptr<Glob>>& globs, const std::vector<uint32_t>& required) {
+        std::vector<Candidate> rest;
+        for ( const Candidate& candidate : patterns )
+            if ( required[candidate.pattern] > 1 || ! packed.add(*globs[candidate.pattern], candidate.pattern) )
+                rest.push_back(candidate);
+
+        patterns = std::move(rest);
     }
 
+    const ShiftAnd& get_packed() const { return packed; }
+
 private:
+    uint32_t id;
     std::string meta_word;
-    std::vector<std::string> patterns;
+    std::vector<Candidate> patterns;
+    std::vector<uint32_t> containing;
+    SegmentTrie segments;
+    ShiftAnd packed;
 };
 
 } // namespace paraglob
@@ -2,28 +2,90 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <memory> // std::unique_ptr
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "paraglob/anchor_trie.h"
+#include "paraglob/glob.h"
 #include "paraglob/node.h"
 
 class AhoCorasickPlus;
 
 namespace paraglob {
 
+/* Tuning knobs applied when a paraglob is compiled */
+struct CompileOptions {
+    /* Precompute a complete transition table for the meta-word automaton so
+       that every byte of a query costs exactly one lookup. */
+    bool full_dfa = false;
+
+    /* Upper bound in bytes for that table. If it would grow larger, the
+       paraglob falls back to the sparse automaton. */
+    size_t dfa_max_size = 64 * 1024 * 1024;
+
+    /* If every meta word is at least this long, queries are scanned with a
+       Wu-Manber scanner that skips over most of a long text instead of
+       stepping the automaton through every byte. It only pays off for a few
+       thousand meta words at most, as larger sets leave little to skip; the
+       driver's -l benchmark shows the crossover. 0, the default, disables
+       it. */
+    size_t skip_scan_min_length = 0;
+
+    /* A meta word with at least this many patterns to verify has the ones
+       that share leading segments matched through a trie of segments,
+       placing each shared segment once per text. 0 disables it. */
+    size_t segment_trie_min_patterns = 16;
+
+    /* A meta word with at least this many patterns to verify has the ones
+       that fit verified together, by a bit-parallel matcher that reads the
+       text once. 0 disables it. */
+    size_t bit_parallel_min_patterns = 32;
+
+    /* Which meta words a pattern is indexed under. With AllWords, it is
+       verified once all the meta words it requires were found. With
+       MostSelective, it is indexed under just the one expected to be the
+       rarest. Short, common meta words then need not be scanned for, and
+       far fewer patterns are verified, while the matcher still checks the
+       rest of the pattern. */
+    enum class IndexPolicy { AllWords, MostSelective };
+    IndexPolicy index_policy = IndexPolicy::AllWords;
+
+    /* Texts typical of the queries. With MostSelective, the meta word
+       occurring least often in them counts as the rarest; without any
+       samples, the longest one does. */
+    std::span<const std::string> sample_texts;
+};
+
+/* Identifies a pattern within its paraglob. Patterns are numbered from 0 in
+   the order they were first added, and keep their ids when serialized. */
+using PatternId = uint32_t;
+
+/* A pattern found by a query, along with the payload it was added with */
+struct PatternMatch {
+    PatternId id;
+    uint64_t payload;
+};
+
+class QueryContext;
+
 class Paraglob {
 public:
     /* Create an empty paraglob to fill with add and finalize with compile */
     Paraglob();
 
     /* Initialize a paraglob from a (large) vector of patterns and compile */
-    Paraglob(const std::vector<std::string>& patterns);
+    Paraglob(const std::vector<std::string>& patterns, const CompileOptions& options = {});
 
-    /* Initialize and compile a paraglob from a serialized one */
-    Paraglob(std::unique_ptr<std::vector<uint8_t>> serialized);
+    /* Initialize and compile a paraglob from a serialized one. The options
+       are not part of the serialization and apply anew. */
+    Paraglob(std::unique_ptr<std::vector<uint8_t>> serialized, const CompileOptions& options = {});
 
     /* Destructor */
     ~Paraglob();
@@ -31,11 +93,54 @@ public:
     /* Add a pattern to the paraglob & return true on success */
     bool add(const std::string& pattern);
 
-    /* Compile the paraglob */
-    void compile();
+    /* Add a pattern with a payload for queries to report, and return its id.
+       A pattern that was added before keeps its id and its first payload.
+       Once compiled, a paraglob takes no new patterns and returns nothing. */
+    std::optional<PatternId> add(const std::string& pattern, uint64_t payload);
+
+    /* Compile the paraglob. Until then, queries find no patterns. Compiling
+       it again does nothing, options included. */
+    void compile(const CompileOptions& options = {});
 
-    /* Get a vector of the patterns that match the input string */
-    std::vector<std::string> get(const std::string& text);
+    /* Get a vector of the patterns that match the input string. A compiled
+       paraglob is not modified by queries, so this may be called from
+       several threads at once. */
+    std::vector<std::string> get(const std::string& text) const;
+
+    /* Get the ids and payloads of the patterns that match the input string,
+       in the same order as get, without copying the patterns. With a limit,
+       the query stops once that many patterns were found to match, and
+       returns just those. */
+    std::vector<PatternMatch> get_matches(const std::string& text, size_t limit = SIZE_MAX) const;
+
+    /* Whether any pattern matches the input string. The query stops at the
+       first match. */
+    bool any(const std::string& text) const;
+
+    /* The number of patterns that match the input string */
+    size_t count(const std::string& text) const;
+
+    /* The first pattern found to match the input string, which need not be
+       the first one get would return. The query stops there. */
+    std::optional<PatternMatch> first(const std::string& text) const;
+
+    /* The queries above work in memory kept for the calling thread. These
+       take a context to work in instead, which also holds the results until
+       its next query. Once a context has grown to what the queries need,
+       they allocate no memory at all. */
+    std::span<const PatternMatch> get_matches(const std::string& text, QueryContext& context,
+                                              size_t limit = SIZE_MAX) const;
+    bool any(const std::string& text, QueryContext& context) const;
+    size_t count(const std::string& text, QueryContext& context) const;
+    std::optional<PatternMatch> first(const std::string& text, QueryContext& context) const;
+
+    /* The pattern and the payload with the given id */
+    const std::string& pattern(PatternId id) const { return this->patterns[id]; }
+    uint64_t payload(PatternId id) const { return this->payloads[id]; }
+
+    /* Get the matching patterns for each of several input strings. Scanning
+       them together hides memory latency when there are many short texts. */
+    std::vector<std::vector<std::string>> get_batch(std::span<const std::string> texts) const;
 
     /* Get a raw byte representation of the paraglob */
     std::unique_ptr<std::vector<uint8_t>> serialize() const;
@@ -47,8 +152,67 @@ public:
     bool operator==(const Paraglob& other) const;
 
 private:
+    friend class QueryContext;
+
+    /* A meta word found in a text, and the offset just past its end */
+    struct MetaMatch {
+        uint32_t id;
+        uint32_t end;
+    };
+
+    /* How a pattern is verified. Patterns made of nothing but literals and
+       stars get a dedicated check for each shape; General ones are handed
+       to their Glob. */
+    enum class Shape : uint8_t {
+        General,
+        Exact,    // 'word', looked up by the whole text
+        Contains, // '*word*', matches whenever the meta word is found
+        Prefix,   // 'word*', found through the prefix trie
+        Suffix,   // '*word', found through the suffix trie
+        Literals, // More than one literal, decided from match positions
+    };
+
+    /* A pattern made of nothing but literals and stars, as the ids of its
+       literals in order. The first one has to start the text unless the
+       pattern starts with a star, and the last one has to end it unless the
+       pattern ends with one. */
+    struct LiteralLayout {
+        Shape shape = Shape::General;
+        std::vector<uint32_t> words;
+        bool anchored_start = false;
+        bool anchored_end = false;
+    };
+
+    /* List the patterns under their meta words and fill the automaton */
+    void index_patterns(const CompileOptions& options);
+
+    /* A query in progress, with the meta words and patterns found so far */
+    struct Query;
+
+    /* Collect the ranks of the patterns that match a text in the context,
+       in no particular order. The query stops once at least limit of them
+       were found. */
+    void find_ranks(const std::string& text, QueryContext& context, size_t limit) const;
+
+    /* Match the patterns that are checked without scanning the text: the
+       ones without meta words, and the ones without wildcards. */
+    void match_unscanned(Query& query) const;
+
+    /* Take a meta word found in the text. The patterns behind it are
+       verified once all the meta words they require were found, and at most
+       once each. */
+    void expand(Query& query, const MetaMatch& match) const;
+
+    /* Verify the patterns that need the whole text scanned first: the
+       anchored ones, and the literal ones that became ready. */
+    void finish_query(Query& query) const;
+
+    /* Decide a literal pattern from where its meta words were found. The
+       matches must be sorted by id, then by end. */
+    bool matches_in_order(const LiteralLayout& layout, const std::vector<MetaMatch>& matches, size_t length) const;
+
     /* Get a vector of the meta words in the pattern. */
-    std::vector<std::string> get_meta_words(const std::string& pattern);
+    std::vector<std::string> get_meta_words(const std::string& pattern) const;
 
     /* Split a string on pairs of square brackets. */
     std::vector<std::string> split_on_brackets(const std::string& in) const;
@@ -57,11 +221,92 @@ private:
     std::vector<std::string> get_patterns() const;
 
     std::unique_ptr<AhoCorasickPlus> my_ac;
+    bool compiled = false;
+
+    /* Every pattern and its payload by id, and the id of each pattern */
+    std::vector<std::string> patterns;
+    std::vector<uint64_t> payloads;
+    std::unordered_map<std::string, PatternId> pattern_ids;
+
+    /* Literal patterns anchored at the start of the text, by their first
+       literal, and the ones anchored only at its end, by their last. */
+    AnchorTrie prefixes{AnchorTrie::Anchor::Start};
+    AnchorTrie suffixes{AnchorTrie::Anchor::End};
+
     std::unordered_map<std::string, paraglob::ParaglobNode> meta_to_node_map;
     std::vector<std::string> meta_words;
+    std::vector<paraglob::ParaglobNode*> meta_nodes; // By meta word id
+
+    /* Every pattern with meta words, compiled once. The nodes refer to them
+       by index. */
+    std::vector<std::unique_ptr<Glob>> globs;
+
+    /* How many distinct meta words of each glob a text must contain before
+       the glob is verified */
+    std::vector<uint32_t> glob_required;
+
+    /* The ids of the meta words each glob may be indexed under */
+    std::vector<std::vector<uint32_t>> glob_keys;
+
+    /* The shape and layout of each glob */
+    std::vector<LiteralLayout> glob_layouts;
+
+    /* The globs without wildcards, by pattern */
+    std::unordered_map<std::string_view, uint32_t> exact_patterns;
+
+    /* The minimum length of a text any pattern with meta words can match */
+    size_t shortest_pattern = SIZE_MAX;
+
+    /* A pattern of only '*' and '?', with the number of '?'s in it */
+    struct Wildcard {
+        size_t length;
+        std::string pattern;
+        uint32_t rank = 0;
+
+        auto operator<=>(const Wildcard&) const = default;
+    };
+
+    /* The wildcard patterns with a '*', and the ones without, each sorted by
+       length once compiled */
+    std::vector<Wildcard> open_wildcards;
+    std::vector<Wildcard> fixed_wildcards;
+
+    /* The other patterns with no meta words, ex: '[ab]' */
+    std::vector<Glob> unindexed_globs;
+
+    /* The ids of all patterns, sorted by pattern, as of compile. Queries
+       collect the ranks of the matching patterns in this list. */
+    std::vector<PatternId> ranked_ids;
+    std::vector<uint32_t> glob_ranks;
+    std::vector<uint32_t> unindexed_ranks;
+};
+
+/* The memory a query works in: what it found so far, and which patterns it
+   already looked at. Reusing one context for many queries saves allocating
+   all of this anew each time. A context can serve any number of paraglobs,
+   but only one query at a time. */
+class QueryContext {
+private:
+    friend class Paraglob;
+
+    /* Start a new query of a paraglob with this many nodes and patterns */
+    void begin(size_t nodes, size_t patterns);
+
+    /* Every stamp is the epoch of the query that last set it, so a new query
+       starts out clean by bumping the epoch instead of clearing them. Stamps
+       left by another paraglob are just as stale. */
+    uint32_t epoch = 0;
+    std::vector<uint32_t> node_seen;      // Node's candidates were counted
+    std::vector<uint32_t> node_contained; // Node's '*word*' patterns were added
+    std::vector<uint32_t> pattern_seen;   // pattern_count is valid
+    std::vector<uint32_t> pattern_count;  // Meta words of the pattern found
+    std::vector<uint32_t> pattern_found;  // Pattern was found to match
 
-    /* Patterns with no meta words, ex: '*' & '?' */
-    std::vector<std::string> single_wildcards;
+    std::vector<Paraglob::MetaMatch> matches; // The meta words found
+    std::vector<uint32_t> ready;              // Literal patterns left to verify
+    std::vector<uint32_t> matched;            // Ranks of the matching patterns
+    std::vector<uint64_t> states;             // For the bit-parallel matchers
+    std::vector<PatternMatch> results;
 };
 
 } // namespace paraglob
@@ -0,0 +1,100 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+//
+// Shared matching of globs with common leading segments.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "paraglob/glob.h"
+
+namespace paraglob {
+
+/* Matches a set of globs that contain a '*' against a whole text, sharing
+   the work for their common leading segments. Glob places its first
+   segment at the start of the text and every later segment but the last
+   at its leftmost occurrence after the previous one. Where that leaves off
+   depends only on the segments so far. So the globs are kept in a trie of
+   their segments, and each branch is placed once per text no matter how
+   many globs share it. Only the last segment, which has to end the text,
+   is checked per glob. */
+class SegmentTrie {
+public:
+    SegmentTrie() : nodes(1) {}
+
+    /* Add a glob under the given id. Returns false if it is left to fnmatch
+       or has no '*'. */
+    bool add(const Glob& glob, uint32_t id);
+
+    bool empty() const { return this->globs == 0; }
+
+    /* How many segments are placed per text with the trie, and how many
+       it would take to match the globs one by one. Last segments are
+       checked per glob either way and not counted. */
+    size_t branches() const { return this->nodes.size() - 1; }
+    size_t placements() const { return this->segments; }
+
+    /* Call f(id) for every glob that matches the whole text */
+    template<typename F>
+    void match(std::string_view text, F&& f) const {
+        this->walk(0, 0, text, f);
+    }
+
+private:
+    // A segment placed after the one of its parent. The first glob to add it
+    // is used to match it.
+    struct Node {
+        std::string key;
+        const Glob* glob = nullptr;
+        uint32_t segment = 0;
+        std::vector<uint32_t> children;
+        std::vector<uint32_t> tails; // Globs whose last segment follows
+    };
+
+    // The last segment of a glob, anchored at the end of the text
+    struct Tail {
+        const Glob* glob;
+        uint32_t id;
+    };
+
+    template<typename F>
+    void walk(uint32_t index, size_t pos, std::string_view text, F& f) const {
+        const Node& node = this->nodes[index];
+
+        for ( uint32_t tail : node.tails ) {
+            const Glob* glob = this->tails[tail].glob;
+            size_t last = glob->segment_count() - 1;
+            size_t size = glob->segment_size(last);
+
+            if ( text.size() >= pos + size && glob->segment_at(last, text, text.size() - size) )
+                f(this->tails[tail].id);
+        }
+
+        for ( uint32_t child : node.children ) {
+            const Node& next = this->nodes[child];
+            size_t found;
+
+            // The children of the root are the first segments, which have to
+            // start the text.
+            if ( index == 0 )
+                found = (text.size() >= next.glob->segment_size(0) && next.glob->segment_at(0, text, 0)) ?
+                            0 :
+                            std::string::npos;
+            else
+                found = next.glob->find_segment(next.segment, text, pos, text.size());
+
+            if ( found != std::string::npos )
+                this->walk(child, found + next.glob->segment_size(next.segment), text, f);
+        }
+    }
+
+    std::vector<Node> nodes; // The root, without a segment, comes first
+    std::vector<Tail> tails;
+    size_t globs = 0;
+    size_t segments = 0;
+};
+
+} // namespace paraglob
@@ -12,20 +12,26 @@ namespace paraglob {
 
 class ParaglobSerializer {
 public:
-    /* Returns serialized version of vector in form:
-       [<n_strings><len_1><str_1>, <len_2><str_2>, ... <len_n><str_n>] */
+    /* Returns serialized version of vector and the payload of each string
+       (0 where missing) in form:
+       [<magic><version><n_strings><len_1><str_1><payload_1>, ... <len_n><str_n><payload_n>] */
     // TODO: When Zeek supports C++17 char should be replaced by std::byte.
-    static std::unique_ptr<std::vector<uint8_t>> serialize(const std::vector<std::string>& v);
+    static std::unique_ptr<std::vector<uint8_t>> serialize(const std::vector<std::string>& v,
+                                                           const std::vector<uint64_t>& payloads = {});
 
-    /* Loads a serialized vector and returns it. */
-    static std::vector<std::string> unserialize(const std::unique_ptr<std::vector<uint8_t>>& vsp);
+    /* Loads a serialized vector and returns it. If given, payloads receives
+       the payload of each string. Data from before payloads were stored, in
+       form [<n_strings><len_1><str_1>, ... <len_n><str_n>], loads with
+       payloads of 0. */
+    static std::vector<std::string> unserialize(const std::unique_ptr<std::vector<uint8_t>>& vsp,
+                                                std::vector<uint64_t>* payloads = nullptr);
 
 private:
     /* Divides up and adds a large integer to the input vector. */
     static void add_int(uint64_t a, std::vector<uint8_t>& target);
 
     /* Gets the large integer beginning at the iterator and moves it forward. */
-    static uint64_t get_int_and_move(std::vector<uint8_t>::iterator& start);
+    static uint64_t get_int_and_move(std::vector<uint8_t>::iterator& start, std::vector<uint8_t>::iterator end);
 };
 
 } // namespace paraglob
@@ -0,0 +1,86 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+//
+// Bit-parallel matching of many short globs in one pass over a text.
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "paraglob/glob.h"
+
+namespace paraglob {
+
+/* Matches a set of globs against a whole text with the Shift-And algorithm.
+   A glob with m positions is a chain of m + 1 states, where state i means
+   that its first i positions were matched. The states of several globs are
+   packed side by side into 64-bit words, and every byte of the text
+   advances all of them at once:
+
+       state = ((state << 1) & accepts[byte]) | (state & loops)
+
+   A '*' is a state that loops on any byte, and '?' or a bracket is a
+   position that accepts more than one byte. A glob matches if its last
+   state is still set once the whole text was read. */
+class ShiftAnd {
+public:
+    /* Add a glob under the given id. Returns false if it cannot be matched
+       this way because it is longer than a word or left to fnmatch. */
+    bool add(const Glob& glob, uint32_t id);
+
+    bool empty() const { return this->words.empty(); }
+
+    /* Call f(id) for every glob that matches the whole text. The states are
+       kept in the given buffer, which can be reused from call to call. */
+    template<typename F>
+    void match(std::string_view text, std::vector<uint64_t>& states, F&& f) const {
+        size_t count = this->words.size();
+        states.resize(count);
+        for ( size_t w = 0; w < count; w++ )
+            states[w] = this->words[w].starts;
+
+        for ( char c : text ) {
+            const uint64_t* accepts = &this->accepts[static_cast<uint8_t>(c) * count];
+            uint64_t alive = 0;
+
+            for ( size_t w = 0; w < count; w++ ) {
+                uint64_t state = states[w];
+                state = ((state << 1) & accepts[w]) | (state & this->words[w].loops);
+                states[w] = state;
+                alive |= state;
+            }
+
+            // No glob can match anymore
+            if ( ! alive )
+                return;
+        }
+
+        for ( size_t w = 0; w < count; w++ ) {
+            uint64_t found = states[w] & this->words[w].finals;
+            while ( found ) {
+                f(this->words[w].ids[std::countr_zero(found)]);
+                found &= found - 1;
+            }
+        }
+    }
+
+private:
+    struct Word {
+        uint64_t starts = 0; // The first state of each glob
+        uint64_t loops = 0;  // States that follow a '*'
+        uint64_t finals = 0; // The last state of each glob
+        size_t used = 0;     // Bits taken by globs so far
+        std::array<uint32_t, 64> ids = {}; // Ids by the bit of their last state
+    };
+
+    std::vector<Word> words;
+
+    // For every byte value, the positions in each word that accept it,
+    // stored as accepts[byte * words.size() + word].
+    std::vector<uint64_t> accepts;
+};
+
+} // namespace paraglob
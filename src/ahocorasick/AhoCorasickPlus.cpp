@@ -22,17 +22,22 @@
  * Modified by Jon Siwek: fix addPattern() to set pattern ID type to "number"
 */
 
+#include <new>
+
 #include "ahocorasick.h"
+#include "flat.h"
 #include "AhoCorasickPlus.h"
 
 AhoCorasickPlus::AhoCorasickPlus ()
 {
     m_automata = ac_trie_create ();
     m_acText = new AC_TEXT_t;
+    m_skipScanner = nullptr;
 }
 
 AhoCorasickPlus::~AhoCorasickPlus ()
 {
+    ac_wm_release (m_skipScanner);
     ac_trie_release (m_automata);
     delete m_acText;
 }
@@ -72,12 +77,34 @@ AhoCorasickPlus::EnumReturnStatus AhoCorasickPlus::addPattern
         case ACERR_TRIE_CLOSED:
             rv = RETURNSTATUS_AUTOMATA_CLOSED;
             break;
+        case ACERR_NO_MEMORY:
+            rv = RETURNSTATUS_FAILED;
+            break;
     }
     return rv;
 }
 
 void AhoCorasickPlus::finalize () {
-    ac_trie_finalize (m_automata);
+    finalize (FinalizeOptions());
+}
+
+void AhoCorasickPlus::finalize (const FinalizeOptions& options) {
+    if (ac_trie_finalize (m_automata) != ACERR_SUCCESS)
+        throw std::bad_alloc ();
+
+    if (options.fullDfa)
+        ac_trie_make_dfa (m_automata, options.dfaMaxSize);
+
+    // Searches only use the flattened trie, so the nodes can go
+    if (ac_trie_release_nodes (m_automata) != ACERR_SUCCESS)
+        throw std::bad_alloc ();
+
+    // The scanner points into the pattern texts, which only stay put once
+    // the flattened trie owns them. The automaton is kept for texts
+    // scanned in batches.
+    if (options.skipScanMinLength && !m_skipScanner)
+        m_skipScanner = ac_wm_create (m_automata->flat->matched,
+                m_automata->flat->matched_size, options.skipScanMinLength);
 }
 
 void AhoCorasickPlus::search (const std::string &text, bool keep)
@@ -106,3 +133,75 @@ std::vector<int> AhoCorasickPlus::findAll (const std::string& text, bool keep)
 
   return IDs;
 }
+
+std::vector<std::vector<AhoCorasickPlus::Match>> AhoCorasickPlus::findAllBatch
+    (std::span<const std::string_view> texts) const
+{
+    std::vector<std::vector<Match>> matches (texts.size());
+
+    if (m_automata->trie_open || !m_automata->flat)
+        return matches;
+
+    const AC_FLAT_t *flat = m_automata->flat;
+
+    struct Lane
+    {
+        size_t      text;
+        size_t      position;
+        uint32_t    state;
+    };
+
+    Lane lanes[BatchLanes];
+    size_t active = 0;
+    size_t next = 0;
+
+    while (active < BatchLanes && next < texts.size())
+        lanes[active++] = {next++, 0, ACF_ROOT};
+
+    while (active)
+    {
+        // Advance every lane by one byte.
+        for (size_t i = 0; i < active; )
+        {
+            Lane &lane = lanes[i];
+            std::string_view text = texts[lane.text];
+
+            if (lane.position == text.size())
+            {
+                // Hand the lane over to the next text, or retire it.
+                if (next < texts.size())
+                    lane = {next++, 0, ACF_ROOT};
+                else
+                    lane = lanes[--active];
+                continue;
+            }
+
+            lane.state = ac_flat_next (flat, lane.state, text[lane.position++]);
+
+            const struct acf_state *state;
+            uint32_t output = ac_flat_first_output (flat, lane.state);
+
+            while (output != ACF_ROOT)
+            {
+                state = &flat->states[output];
+                for (uint32_t j = 0; j < state->matched_size; j++)
+                    matches[lane.text].push_back({(unsigned int) lane.position,
+                            (PatternId) flat->matched[state->matched + j].id.u.number});
+                output = state->output;
+            }
+
+            ac_flat_prefetch (flat, lane.state);
+            i++;
+        }
+
+        // By now the states of the first lanes have arrived; start loading
+        // their edges before the next round needs them.
+        if (!flat->delta)
+        {
+            for (size_t i = 0; i < active; i++)
+                ac_flat_prefetch_edges (flat, lanes[i].state);
+        }
+    }
+
+    return matches;
+}
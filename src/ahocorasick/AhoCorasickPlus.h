@@ -25,14 +25,17 @@
 #ifndef AHOCORASICKPPW_H_
 #define AHOCORASICKPPW_H_
 
+#include <cstddef>
+#include <cstring>
+#include <span>
 #include <string>
 #include <string_view>
 #include <queue>
 #include <vector>
 
-// Forward declarations
-struct ac_trie;
-struct ac_text;
+#include "ahocorasick.h"
+#include "flat.h"
+#include "wumanber.h"
 
 
 class AhoCorasickPlus
@@ -57,6 +60,23 @@ public:
         PatternId       id;
     };
 
+    struct FinalizeOptions
+    {
+        // Precompute a complete transition table over byte equivalence
+        // classes, so that scanning costs exactly one lookup per byte.
+        bool            fullDfa = false;
+
+        // The table is only built if it fits into this many bytes;
+        // otherwise scanning keeps using the sparse trie.
+        size_t          dfaMaxSize = 64 * 1024 * 1024;
+
+        // If every pattern is at least this long, single texts are scanned
+        // with a Wu-Manber scanner that skips most of the text instead of
+        // looking at every byte. Large pattern sets leave little to skip, so
+        // it is off by default (0).
+        size_t          skipScanMinLength = 0;
+    };
+
 public:
 
     AhoCorasickPlus();
@@ -64,14 +84,133 @@ public:
 
     EnumReturnStatus addPattern (std::string_view pattern, PatternId id, bool copy = false);
     void             finalize   ();
+    void             finalize   (const FinalizeOptions& options);
 
     void search   (const std::string &text, bool keep);
     std::vector<int> findAll (const std::string& text, bool keep);
 
+    // Scans a single, self-contained text and calls visitor(Match) for every
+    // pattern found. Matches come ordered by their end position, or by their
+    // start position if the skip scanner is in use. The scan stops early if
+    // the visitor returns false. No state is kept between calls and nothing
+    // is allocated, so this is safe to call concurrently. Returns false if
+    // the visitor stopped the scan.
+    template <typename Visitor>
+    bool visit (std::string_view text, Visitor&& visitor) const;
+
+    // Scans several independent texts at once and returns the matches found
+    // in each of them, ordered by their end position. The texts are walked
+    // in lockstep, BatchLanes at a time, and the states each one needs next
+    // are prefetched, so the cache misses of different texts overlap.
+    static constexpr size_t BatchLanes = 8;
+    std::vector<std::vector<Match>> findAllBatch (std::span<const std::string_view> texts) const;
+
 private:
 
+    template <typename Visitor>
+    bool visitSkipping (std::string_view text, Visitor&& visitor) const;
+
     struct ac_trie      *m_automata;
     struct ac_text      *m_acText;
+    struct ac_wm        *m_skipScanner;
 };
 
+template <typename Visitor>
+bool AhoCorasickPlus::visit (std::string_view text, Visitor&& visitor) const
+{
+    if (m_automata->trie_open || !m_automata->flat)
+        return true;
+
+    if (m_skipScanner)
+        return visitSkipping (text, visitor);
+
+    const AC_FLAT_t *flat = m_automata->flat;
+    const AC_ALPHABET_t *data = text.data();
+    size_t size = text.size();
+    size_t position = 0;
+    size_t skip;
+    uint32_t state = ACF_ROOT;
+
+    while (position < size)
+    {
+        // Pass through chains in one go where possible
+        if (!(skip = ac_flat_follow_run (flat, &state, &data[position],
+                        size - position)))
+            state = ac_flat_next (flat, state, data[position++]);
+        else
+            position += skip;
+
+        uint32_t output = ac_flat_first_output (flat, state);
+
+        // Report the patterns of every final state on the output chain
+        while (output != ACF_ROOT)
+        {
+            const struct acf_state *o = &flat->states[output];
+            const AC_PATTERN_t *patterns = &flat->matched[o->matched];
+
+            for (unsigned int j = 0; j < o->matched_size; j++)
+            {
+                Match match = {(unsigned int) position,
+                               (PatternId) patterns[j].id.u.number};
+                if (!visitor(match))
+                    return false;
+            }
+
+            output = o->output;
+        }
+    }
+
+    return true;
+}
+
+template <typename Visitor>
+bool AhoCorasickPlus::visitSkipping (std::string_view text, Visitor&& visitor) const
+{
+    const AC_WM_t *wm = m_skipScanner;
+    const AC_ALPHABET_t *data = text.data();
+    size_t size = text.size();
+
+    if (size < wm->window)
+        return true;
+
+    // The position of the last block of the current window
+    size_t position = wm->window - ACWM_BLOCK;
+    size_t last = size - ACWM_BLOCK;
+
+    while (position <= last)
+    {
+        uint32_t hash = ac_wm_hash (&data[position]);
+        unsigned int shift = wm->shift[hash];
+
+        if (shift)
+        {
+            position += shift;
+            continue;
+        }
+
+        // The block ends the window of some pattern; verify those
+        size_t start = position + ACWM_BLOCK - wm->window;
+
+        for (uint32_t k = wm->buckets[hash]; k < wm->buckets[hash + 1]; k++)
+        {
+            const AC_PATTERN_t *pattern = &wm->patterns[wm->candidates[k]];
+            size_t length = pattern->ptext.length;
+
+            if (length > size - start
+                    || pattern->ptext.astring[0] != data[start]
+                    || memcmp (pattern->ptext.astring, &data[start], length))
+                continue;
+
+            Match match = {(unsigned int) (start + length),
+                           (PatternId) pattern->id.u.number};
+            if (!visitor(match))
+                return false;
+        }
+
+        position++;
+    }
+
+    return true;
+}
+
 #endif /* AHOCORASICKPPW_H_ */
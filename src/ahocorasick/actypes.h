@@ -118,9 +118,11 @@ typedef enum ac_status
 {
     ACERR_SUCCESS = 0,          /**< No error occurred */
     ACERR_DUPLICATE_PATTERN,    /**< Duplicate patterns */
-    ACERR_LONG_PATTERN,         /**< Pattern length is too long */
+    ACERR_LONG_PATTERN,         /**< Pattern length is too long (unused; 
+                                 * patterns are not limited in length) */
     ACERR_ZERO_PATTERN,         /**< Empty pattern (zero length) */
-    ACERR_TRIE_CLOSED       /**< Trie is closed. */
+    ACERR_TRIE_CLOSED,      /**< Trie is closed. */
+    ACERR_NO_MEMORY         /**< Memory could not be allocated */
 } AC_STATUS_t;
 
 /**
@@ -141,20 +143,11 @@ typedef int (*AC_MATCH_CALBACK_f)(AC_MATCH_t *, void *);
  */
 typedef void (*MF_REPLACE_CALBACK_f)(AC_TEXT_t *, void *);
 
-/**
- * Maximum accepted length of search/replace pattern
- */
-#define AC_PATTRN_MAX_LENGTH 1024
-
 /**
  * Replacement buffer size 
  */
 #define MF_REPLACEMENT_BUFFER_SIZE 2048
 
-#if (MF_REPLACEMENT_BUFFER_SIZE <= AC_PATTRN_MAX_LENGTH)
-#error "REPLACEMENT_BUFFER_SIZE must be bigger than AC_PATTRN_MAX_LENGTH"
-#endif
-
 typedef enum act_working_mode
 {
     AC_WORKING_MODE_SEARCH = 0, /* Default */
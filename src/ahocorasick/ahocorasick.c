@@ -24,17 +24,15 @@
 
 #include "node.h"
 #include "ahocorasick.h"
+#include "flat.h"
 #include "mpool.h"
 
 /* Privates */
 
 static void ac_trie_set_failure
-    (ACT_NODE_t *node, AC_ALPHABET_t *alphas);
+    (AC_TRIE_t *thiz, ACT_NODE_t *node, ACT_NODE_t *next, AC_ALPHABET_t alpha);
 
-static void ac_trie_traverse_setfailure 
-    (ACT_NODE_t *node, AC_ALPHABET_t *prefix);
-
-static void ac_trie_traverse_action 
+static int ac_trie_traverse_action 
     (ACT_NODE_t *node, void(*func)(ACT_NODE_t *), int top_down);
 
 static void ac_trie_reset 
@@ -48,7 +46,7 @@ static int ac_trie_match_handler
 extern void mf_repdata_init (AC_TRIE_t *thiz);
 extern void mf_repdata_reset (MF_REPLACEMENT_DATA_t *rd);
 extern void mf_repdata_release (MF_REPLACEMENT_DATA_t *rd);
-extern void mf_repdata_allocbuf (MF_REPLACEMENT_DATA_t *rd);
+extern int  mf_repdata_allocbuf (MF_REPLACEMENT_DATA_t *rd);
 
 
 /**
@@ -62,15 +60,15 @@ AC_TRIE_t *ac_trie_create (void)
     thiz->mp = mpool_create(0);
     
     thiz->root = node_create (thiz);
+    thiz->flat = NULL;
     
     thiz->patterns_count = 0;
+    thiz->longest_pattern = 0;
     
     mf_repdata_init (thiz);
     ac_trie_reset (thiz);    
     thiz->text = NULL;
-    thiz->position = 0;
     
-    thiz->wm = AC_WORKING_MODE_SEARCH;
     thiz->trie_open = 1;
     
     return thiz;
@@ -101,9 +99,6 @@ AC_STATUS_t ac_trie_add (AC_TRIE_t *thiz, AC_PATTERN_t *patt, int copy)
     if (!patt->ptext.length)
         return ACERR_ZERO_PATTERN;
     
-    if (patt->ptext.length > AC_PATTRN_MAX_LENGTH)
-        return ACERR_LONG_PATTERN;
-    
     for (i = 0; i < patt->ptext.length; i++)
     {
         alpha = patt->ptext.astring[i];
@@ -127,31 +122,144 @@ AC_STATUS_t ac_trie_add (AC_TRIE_t *thiz, AC_PATTERN_t *patt, int copy)
     node_accept_pattern (n, patt, copy);
     thiz->patterns_count++;
     
+    if (patt->ptext.length > thiz->longest_pattern)
+        thiz->longest_pattern = patt->ptext.length;
+    
     return ACERR_SUCCESS;
 }
 
 /**
  * @brief Finalizes the preprocessing stage and gets the trie ready
  * 
- * Locates the failure node for all nodes and collects all matched 
- * pattern for each node. It also sorts outgoing edges of node, so binary 
- * search could be performed on them. After calling this function the automate 
- * will be finalized and you can not add new patterns to the automate.
+ * Visits the nodes in breadth-first order, so by the time a node is reached 
+ * all nodes of smaller depth - which includes everything on its failure 
+ * chain - are complete. For each node it sorts the outgoing edges, so binary 
+ * search could be performed on them, links the node to the next final node 
+ * on its failure chain and locates the failure nodes of its children. This 
+ * takes time linear in the size of the trie and uses no recursion, so there 
+ * is no limit on the pattern length. Finally it compacts the trie into its 
+ * flattened form which is used for searching. After calling this function 
+ * the automate will be finalized and you can not add new patterns to the 
+ * automate. Finalizing it again does nothing.
  * 
  * @param thiz pointer to the trie
+ * 
+ * @return ACERR_SUCCESS, or ACERR_NO_MEMORY if the flattened form could not 
+ * be built, in which case the trie stays open
  *****************************************************************************/
-void ac_trie_finalize (AC_TRIE_t *thiz)
+AC_STATUS_t ac_trie_finalize (AC_TRIE_t *thiz)
 {
-    AC_ALPHABET_t prefix[AC_PATTRN_MAX_LENGTH]; 
+    size_t i, head = 0, tail = 0;
+    size_t capacity = 256;
+    ACT_NODE_t *node;
+    ACT_NODE_t **queue, **grown;
+    
+    if (!thiz->trie_open)
+        return ACERR_SUCCESS;
+    
+    if (!(queue = (ACT_NODE_t **) malloc (capacity * sizeof(ACT_NODE_t *))))
+        return ACERR_NO_MEMORY;
+    queue[tail++] = thiz->root;
+    
+    while (head < tail)
+    {
+        node = queue[head++];
+        
+        node_sort_edges (node);
+        node_link_output (node);
+        
+        for (i = 0; i < node->outgoing_size; i++)
+        {
+            ac_trie_set_failure (thiz, node, node->outgoing[i].next, 
+                    node->outgoing[i].alpha);
+            
+            if (tail == capacity)
+            {
+                capacity *= 2;
+                grown = (ACT_NODE_t **) realloc 
+                        (queue, capacity * sizeof(ACT_NODE_t *));
+                if (!grown)
+                {
+                    free (queue);
+                    return ACERR_NO_MEMORY;
+                }
+                queue = grown;
+            }
+            queue[tail++] = node->outgoing[i].next;
+        }
+    }
     
-    /* 'prefix' defined here, because ac_trie_traverse_setfailure() calls
-     * itself recursively */
-    ac_trie_traverse_setfailure (thiz->root, prefix);
+    free (queue);
     
-    ac_trie_traverse_action (thiz->root, node_collect_matches, 1);
-    mf_repdata_allocbuf (&thiz->repdata);
+    if (!(thiz->flat = ac_flat_create (thiz)))
+        return ACERR_NO_MEMORY;
+    
+    if (!mf_repdata_allocbuf (&thiz->repdata))
+    {
+        ac_flat_release (thiz->flat);
+        thiz->flat = NULL;
+        return ACERR_NO_MEMORY;
+    }
     
     thiz->trie_open = 0; /* Do not accept patterns any more */
+    return ACERR_SUCCESS;
+}
+
+/**
+ * @brief Precomputes a complete transition table for a finalized trie
+ * 
+ * Afterwards every input byte costs exactly one table lookup, as no failure 
+ * transitions need to be followed anymore. The table holds one row per trie 
+ * node, so it is only built if it fits into the given size.
+ * 
+ * @param thiz pointer to the trie
+ * @param max_size the maximum size of the table in bytes
+ * 
+ * @return 1 if the table was built, 0 if the trie keeps searching through its 
+ * sparse edges
+ *****************************************************************************/
+int ac_trie_make_dfa (AC_TRIE_t *thiz, size_t max_size)
+{
+    if (thiz->trie_open || !thiz->flat)
+        return 0;
+    
+    return ac_flat_make_dfa (thiz->flat, max_size);
+}
+
+/**
+ * @brief Releases the nodes and the memory pool of a finalized trie, which 
+ * then keeps only its flattened form.
+ * 
+ * Searching is not affected, but the trie can no longer be used for 
+ * replacement nor be displayed. Does nothing unless the trie is finalized.
+ * 
+ * @param thiz pointer to the trie
+ * 
+ * @return ACERR_SUCCESS, or ACERR_NO_MEMORY if the pattern texts could not be 
+ * moved into the flattened form, in which case the nodes are kept. It is also 
+ * returned if the edges of some nodes could not be released; these leak, but 
+ * the nodes are gone and searching still works.
+ *****************************************************************************/
+AC_STATUS_t ac_trie_release_nodes (AC_TRIE_t *thiz)
+{
+    int released;
+    
+    if (thiz->trie_open || !thiz->root)
+        return ACERR_SUCCESS;
+    
+    if (!ac_flat_own_texts (thiz->flat))
+        return ACERR_NO_MEMORY;
+    
+    /* It must be called with a 0 top-down parameter. Nodes visited before a 
+     * failure have already lost their edges, so the pool goes either way. */
+    released = ac_trie_traverse_action (thiz->root, node_release_vectors, 0);
+    mpool_free (thiz->mp);
+    
+    thiz->mp = NULL;
+    thiz->root = NULL;
+    thiz->last_node = NULL;
+    
+    return released ? ACERR_SUCCESS : ACERR_NO_MEMORY;
 }
 
 /**
@@ -175,107 +283,161 @@ void ac_trie_finalize (AC_TRIE_t *thiz)
 int ac_trie_search (AC_TRIE_t *thiz, AC_TEXT_t *text, int keep, 
         AC_MATCH_CALBACK_f callback, void *user)
 {
-    size_t position;
-    ACT_NODE_t *current;
-    ACT_NODE_t *next;
+    ac_cursor_settext (&thiz->cursor, text, keep);
+    return ac_cursor_search (thiz, &thiz->cursor, callback, user);
+}
+
+/**
+ * @brief sets the input text to be searched by a function call to _findnext()
+ * 
+ * @param thiz The pointer to the trie
+ * @param text The text to be searched. The owner of the text is the 
+ * calling program and no local copy is made, so it must be valid until you 
+ * have done with it.
+ * @param keep Indicates that if the given text is the sequel of the previous
+ * one or not; 1: it is, 0: it is not
+ *****************************************************************************/
+void ac_trie_settext (AC_TRIE_t *thiz, AC_TEXT_t *text, int keep)
+{
+    ac_cursor_settext (&thiz->cursor, text, keep);
+}
+
+/**
+ * @brief finds the next match in the input text which is set by _settext()
+ * 
+ * @param thiz The pointer to the trie
+ * @return A pointer to the matched structure
+ *****************************************************************************/
+AC_MATCH_t ac_trie_findnext (AC_TRIE_t *thiz)
+{
+    return ac_cursor_findnext (thiz, &thiz->cursor);
+}
+
+/**
+ * @brief Sets the input text of a cursor
+ * 
+ * @param cursor The cursor
+ * @param text The text to be searched. No local copy is made, so it must be 
+ * valid until you have done with it. May be NULL to only reset the cursor.
+ * @param keep Indicates that if the given text is the sequel of the previous
+ * one or not; 1: it is, 0: it is not
+ *****************************************************************************/
+void ac_cursor_settext (AC_CURSOR_t *cursor, const AC_TEXT_t *text, int keep)
+{
+    if (keep && cursor->text)
+    {
+        cursor->base_position += cursor->text->length;
+    }
+    else if (!keep)
+    {
+        cursor->base_position = 0;
+        cursor->state = ACF_ROOT;
+    }
+    
+    cursor->text = text;
+    cursor->position = 0;
+    cursor->output = ACF_ROOT;
+}
+
+/**
+ * @brief Searches the input text of a cursor. 
+ * 
+ * The trie is only read, so several threads may search it at the same time 
+ * as long as each one uses its own cursor. A search interrupted by the 
+ * call-back can be resumed by calling this function again.
+ * 
+ * @param thiz pointer to the trie
+ * @param cursor the cursor, set up by ac_cursor_settext()
+ * @param callback when a match occurs this function will be called. The 
+ * call-back function in turn after doing its job, will return an integer 
+ * value, 0 means continue search, and non-0 value means stop search and return 
+ * to the caller.
+ * @param user this parameter will be send to the call-back function
+ * 
+ * @return
+ * -1:  failed; trie is not finalized
+ *  0:  success; input text was searched to the end
+ *  1:  success; input text was searched partially. (callback broke the loop)
+ *****************************************************************************/
+int ac_cursor_search (const AC_TRIE_t *thiz, AC_CURSOR_t *cursor, 
+        AC_MATCH_CALBACK_f callback, void *user)
+{
+    size_t position, skip;
+    uint32_t current, output;
+    const AC_TEXT_t *text = cursor->text;
+    const AC_FLAT_t *flat = thiz->flat;
+    const struct acf_state *state;
     AC_MATCH_t match;
 
-    if (thiz->trie_open)
+    if (thiz->trie_open || !flat)
         return -1;  /* Trie must be finalized first. */
     
-    if (thiz->wm == AC_WORKING_MODE_FINDNEXT)
-        position = thiz->position;
-    else
-        position = 0;
-    
-    current = thiz->last_node;
+    if (!text)
+        return 0;
     
-    if (!keep)
-        ac_trie_reset (thiz);
+    position = cursor->position;
+    current = cursor->state;
+    output = cursor->output; /* Resume the pending output chain */
     
     /* This is the main search loop.
      * It must be kept as lightweight as possible.
      */
-    while (position < text->length)
+    for (;;)
     {
-        if (!(next = node_find_next_bs (current, text->astring[position])))
-        {
-            if(current->failure_node /* We are not in the root node */)
-                current = current->failure_node;
-            else
-                position++;
-        }
-        else
-        {
-            current = next;
-            position++;
-        }
-        
-        if (current->final && next)
-        /* We check 'next' to find out if we have come here after a alphabet
-         * transition or due to a fail transition. in second case we should not 
-         * report match, because it has already been reported */
+        /* Report the patterns of every final state on the output chain */
+        while (output != ACF_ROOT)
         {
             /* Found a match! */
-            match.position = position + thiz->base_position;
-            match.size = current->matched_size;
-            match.patterns = current->matched;
+            state = &flat->states[output];
+            match.position = position + cursor->base_position;
+            match.size = state->matched_size;
+            match.patterns = &flat->matched[state->matched];
+            output = state->output;
             
             /* Do call-back */
             if (callback(&match, user))
             {
-                if (thiz->wm == AC_WORKING_MODE_FINDNEXT) {
-                    thiz->position = position;
-                    thiz->last_node = current;
-                }
+                cursor->position = position;
+                cursor->state = current;
+                cursor->output = output;
                 return 1;
             }
         }
+        
+        if (position >= text->length)
+            break;
+        
+        /* Pass through chains in one go where possible */
+        if (!(skip = ac_flat_follow_run (flat, &current, 
+                &text->astring[position], text->length - position)))
+            current = ac_flat_next (flat, current, text->astring[position++]);
+        else
+            position += skip;
+        
+        output = ac_flat_first_output (flat, current);
     }
     
     /* Save status variables */
-    thiz->last_node = current;
-    thiz->base_position += position;
+    cursor->position = position;
+    cursor->state = current;
+    cursor->output = ACF_ROOT;
     
     return 0;
 }
 
 /**
- * @brief sets the input text to be searched by a function call to _findnext()
- * 
- * @param thiz The pointer to the trie
- * @param text The text to be searched. The owner of the text is the 
- * calling program and no local copy is made, so it must be valid until you 
- * have done with it.
- * @param keep Indicates that if the given text is the sequel of the previous
- * one or not; 1: it is, 0: it is not
- *****************************************************************************/
-void ac_trie_settext (AC_TRIE_t *thiz, AC_TEXT_t *text, int keep)
-{
-    if (!keep)
-        ac_trie_reset (thiz);
-    
-    thiz->text = text;
-    thiz->position = 0;
-}
-
-/**
- * @brief finds the next match in the input text which is set by _settext()
+ * @brief finds the next match in the input text of a cursor
  * 
  * @param thiz The pointer to the trie
- * @return A pointer to the matched structure
+ * @param cursor The cursor, set up by ac_cursor_settext()
+ * @return The match; its size is 0 if there are no more matches
  *****************************************************************************/
-AC_MATCH_t ac_trie_findnext (AC_TRIE_t *thiz)
+AC_MATCH_t ac_cursor_findnext (const AC_TRIE_t *thiz, AC_CURSOR_t *cursor)
 {
     AC_MATCH_t match;
     
-    thiz->wm = AC_WORKING_MODE_FINDNEXT;
     match.size = 0;
-    
-    ac_trie_search (thiz, thiz->text, 1, 
-            ac_trie_match_handler, (void *)&match);
-    
-    thiz->wm = AC_WORKING_MODE_SEARCH;
+    ac_cursor_search (thiz, cursor, ac_trie_match_handler, (void *)&match);
     
     return match;
 }
@@ -288,10 +450,14 @@ AC_MATCH_t ac_trie_findnext (AC_TRIE_t *thiz)
 void ac_trie_release (AC_TRIE_t *thiz)
 {
     /* It must be called with a 0 top-down parameter */
-    ac_trie_traverse_action (thiz->root, node_release_vectors, 0);
+    if (thiz->root)
+    {
+        ac_trie_traverse_action (thiz->root, node_release_vectors, 0);
+        mpool_free(thiz->mp);
+    }
+    ac_flat_release (thiz->flat);
     
     mf_repdata_release (&thiz->repdata);
-    mpool_free(thiz->mp);
     free(thiz);
 }
 
@@ -303,7 +469,8 @@ void ac_trie_release (AC_TRIE_t *thiz)
  *****************************************************************************/
 void ac_trie_display (AC_TRIE_t *thiz)
 {
-    ac_trie_traverse_action (thiz->root, node_display, 1);
+    if (thiz->root)
+        ac_trie_traverse_action (thiz->root, node_display, 1);
 }
 
 /**
@@ -331,68 +498,36 @@ static void ac_trie_reset (AC_TRIE_t *thiz)
 {
     thiz->last_node = thiz->root;
     thiz->base_position = 0;
+    thiz->cursor.text = NULL;
+    ac_cursor_settext (&thiz->cursor, NULL, 0);
     mf_repdata_reset (&thiz->repdata);
 }
 
 /**
- * @brief Finds and bookmarks the failure transition for the given node.
+ * @brief Finds and bookmarks the failure transition for a child node.
+ * 
+ * The failure node of @p next is reached by following the failure chain of
+ * its parent @p node to the first node that has an edge labeled @p alpha.
+ * All nodes on that chain are shallower than @p node, so their edges are 
+ * already sorted and their failure nodes already known.
  * 
- * @param node the node pointer
- * @param prefix The array that contain the prefix that leads the path from
- * root the the node.
+ * @param thiz pointer to the trie
+ * @param node the parent node
+ * @param next the child node
+ * @param alpha the label of the edge from @p node to @p next
  *****************************************************************************/
 static void ac_trie_set_failure
-    (ACT_NODE_t *node, AC_ALPHABET_t *prefix)
+    (AC_TRIE_t *thiz, ACT_NODE_t *node, ACT_NODE_t *next, AC_ALPHABET_t alpha)
 {
-    size_t i, j;
     ACT_NODE_t *n;
-    ACT_NODE_t *root = node->trie->root;
-    
-    if (node == root)
-        return; /* Failure transition is not defined for the root */
     
-    for (i = 1; i < node->depth; i++)
+    for (n = node->failure_node; n; n = n->failure_node)
     {
-        n = root;
-        for (j = i; j < node->depth && n; j++)
-            n = node_find_next (n, prefix[j]);
-        if (n)
-        {
-            node->failure_node = n;
-            break;
-        }
+        if ((next->failure_node = node_find_next_bs (n, alpha)))
+            return;
     }
     
-    if (!node->failure_node)
-        node->failure_node = root;
-}
-
-/**
- * @brief Sets the failure transition node for all nodes
- * 
- * Traverse all trie nodes using DFS (Depth First Search), meanwhile it set
- * the failure node for every node it passes through. this function is called 
- * after adding last pattern to trie.
- * 
- * @param node The pointer to the root node
- * @param prefix The array that contain the prefix that leads the path from
- * root the the node
- *****************************************************************************/
-static void ac_trie_traverse_setfailure 
-    (ACT_NODE_t *node, AC_ALPHABET_t *prefix)
-{
-    size_t i;
-    
-    /* In each node, look for its failure node */
-    ac_trie_set_failure (node, prefix);
-    
-    for (i = 0; i < node->outgoing_size; i++)
-    {
-        prefix[node->depth] = node->outgoing[i].alpha; /* Make the prefix */
-        
-        /* Recursively call itself to traverse all nodes */
-        ac_trie_traverse_setfailure (node->outgoing[i].next, prefix);
-    }
+    next->failure_node = thiz->root;
 }
 
 /**
@@ -400,23 +535,58 @@ static void ac_trie_traverse_setfailure
  * given @param func on all nodes. At top level it should be called by 
  * sending the the root node.
  * 
+ * The traversal keeps its own stack on the heap, so its stack usage does not 
+ * depend on the depth of the trie.
+ * 
  * @param node Pointer to trie root node
  * @param func The function that must be applied to all nodes
  * @param top_down Indicates that if the action should be applied to the note
- * itself and then to its children or vise versa.
+ * itself before its children are visited. Otherwise it is applied once the 
+ * children have been pushed to the stack, so @p func may release the node's 
+ * edges.
+ * @return 1 on success, 0 if memory could not be allocated, in which case 
+ * @p func was applied to only some of the nodes
  *****************************************************************************/
-static void ac_trie_traverse_action 
+static int ac_trie_traverse_action 
     (ACT_NODE_t *node, void(*func)(ACT_NODE_t *), int top_down)
 {
-    size_t i;
+    size_t i, size = 0;
+    size_t capacity = 256;
+    ACT_NODE_t **stack, **grown;
     
-    if (top_down)
-        func (node);
+    if (!(stack = (ACT_NODE_t **) malloc (capacity * sizeof(ACT_NODE_t *))))
+        return 0;
+    stack[size++] = node;
     
-    for (i = 0; i < node->outgoing_size; i++)
-        /* Recursively call itself to traverse all nodes */
-        ac_trie_traverse_action (node->outgoing[i].next, func, top_down);
+    while (size)
+    {
+        node = stack[--size];
+        
+        if (top_down)
+            func (node);
+        
+        if (size + node->outgoing_size > capacity)
+        {
+            while (size + node->outgoing_size > capacity)
+                capacity *= 2;
+            grown = (ACT_NODE_t **) realloc 
+                    (stack, capacity * sizeof(ACT_NODE_t *));
+            if (!grown)
+            {
+                free (stack);
+                return 0;
+            }
+            stack = grown;
+        }
+        
+        /* Push in reverse, so the children are visited in edge order */
+        for (i = node->outgoing_size; i > 0; i--)
+            stack[size++] = node->outgoing[i - 1].next;
+        
+        if (!top_down)
+            func (node);
+    }
     
-    if (!top_down)
-        func (node);
+    free (stack);
+    return 1;
 }
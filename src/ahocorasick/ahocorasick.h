@@ -21,6 +21,8 @@
 #ifndef _AHOCORASICK_H_
 #define _AHOCORASICK_H_
 
+#include <stdint.h>
+
 #include "replace.h"
 
 #ifdef __cplusplus
@@ -29,16 +31,33 @@ extern "C" {
 
 /* Forward declaration */
 struct act_node;
+struct ac_flat;
 struct mpool;
 
+/*
+ * The scan state of a search. The trie itself is not modified by searching,
+ * so any number of cursors can search the same trie at the same time.
+ */
+typedef struct ac_cursor
+{
+    const AC_TEXT_t *text;  /**< The input chunk being searched */
+    size_t position;        /**< Position of the next byte in the chunk */
+    size_t base_position;   /**< Position of the chunk in the whole input */
+    uint32_t state;         /**< The current state */
+    uint32_t output;        /**< Next state on the output chain of the current
+                             * state that is still to be reported */
+} AC_CURSOR_t;
+
 /* 
  * The A.C. Trie data structure 
  */
 typedef struct ac_trie
 {
-    struct act_node *root;      /**< The root node of the trie */
+    struct act_node *root;      /**< The root node of the trie; NULL once 
+                                 * the nodes have been released */
     
     size_t patterns_count;      /**< Total patterns in the trie */
+    size_t longest_pattern;     /**< Length of the longest pattern */
     
     short trie_open; /**< This flag indicates that if trie is finalized 
                           * or not. After finalizing the trie you can not 
@@ -46,23 +65,27 @@ typedef struct ac_trie
     
     struct mpool *mp;   /**< Memory pool */
     
+    struct ac_flat *flat; /**< The flattened trie used for searching; it is 
+                           * built when the trie is finalized */
+    
     /* ******************* Thread specific part ******************** */
     
     /* It is possible to search a long input chunk by chunk. In order to
      * connect these chunks and make a continuous view of the input, we need 
-     * the following variables.
+     * the following variables. Concurrent searches use a cursor of their own
+     * instead (see ac_cursor_search()).
      */
-    struct act_node *last_node; /**< Last node we stopped at */
+    AC_CURSOR_t cursor; /**< The scan state of ac_trie_search() and 
+                         * ac_trie_findnext() */
+    
+    struct act_node *last_node; /**< Last node we stopped at (replace) */
     size_t base_position; /**< Represents the position of the current chunk,
-                           * related to whole input text */
+                           * related to whole input text (replace) */
     
-    AC_TEXT_t *text;    /**< A helper variable to hold the input chunk */
-    size_t position;    /**< A helper variable to hold the relative current 
-                         * position in the given text */
+    AC_TEXT_t *text;    /**< A helper variable to hold the input chunk 
+                         * (replace) */
     
     MF_REPLACEMENT_DATA_t repdata;    /**< Replacement data structure */
-    
-    ACT_WORKING_MODE_t wm; /**< Working mode */
         
 } AC_TRIE_t;
 
@@ -72,7 +95,9 @@ typedef struct ac_trie
 
 AC_TRIE_t *ac_trie_create (void);
 AC_STATUS_t ac_trie_add (AC_TRIE_t *thiz, AC_PATTERN_t *patt, int copy);
-void ac_trie_finalize (AC_TRIE_t *thiz);
+AC_STATUS_t ac_trie_finalize (AC_TRIE_t *thiz);
+int  ac_trie_make_dfa (AC_TRIE_t *thiz, size_t max_size);
+AC_STATUS_t ac_trie_release_nodes (AC_TRIE_t *thiz);
 void ac_trie_release (AC_TRIE_t *thiz);
 void ac_trie_display (AC_TRIE_t *thiz);
 
@@ -82,6 +107,11 @@ int  ac_trie_search (AC_TRIE_t *thiz, AC_TEXT_t *text, int keep,
 void ac_trie_settext (AC_TRIE_t *thiz, AC_TEXT_t *text, int keep);
 AC_MATCH_t ac_trie_findnext (AC_TRIE_t *thiz);
 
+void ac_cursor_settext (AC_CURSOR_t *cursor, const AC_TEXT_t *text, int keep);
+int  ac_cursor_search (const AC_TRIE_t *thiz, AC_CURSOR_t *cursor, 
+        AC_MATCH_CALBACK_f callback, void *param);
+AC_MATCH_t ac_cursor_findnext (const AC_TRIE_t *thiz, AC_CURSOR_t *cursor);
+
 int  multifast_replace (AC_TRIE_t *thiz, AC_TEXT_t *text, 
         MF_REPLACE_MODE_t mode, MF_REPLACE_CALBACK_f callback, void *param);
 void multifast_rep_flush (AC_TRIE_t *thiz, int keep);
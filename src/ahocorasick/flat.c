@@ -0,0 +1,469 @@
+/*
+ * flat.c: Implements the flattened form of a finalized trie
+ * This file is part of multifast.
+ *
+ * See the file "COPYING" in the main distribution directory for copyright.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "node.h"
+#include "ahocorasick.h"
+#include "flat.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ACF_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+/* Privates */
+static ACT_NODE_t **ac_flat_enumerate (struct ac_trie *trie, size_t *size);
+static int ac_flat_place_chain (ACT_NODE_t ***nodes, size_t *size, 
+        size_t *capacity, ACT_NODE_t *node);
+
+/**
+ * @brief Builds the flattened form of a finalized trie
+ *
+ * The outgoing edges of each node must already be sorted. See
+ * ac_flat_enumerate() for the order of the nodes. A node with a single edge
+ * that reports no match, neither its own nor through its output link, 
+ * becomes a chain state if its parent, other than the root, has a single 
+ * edge, too. All others become full states.
+ *
+ * @param trie pointer to the finalized trie
+ * @return The flattened trie, or NULL if memory could not be allocated
+ *****************************************************************************/
+AC_FLAT_t *ac_flat_create (struct ac_trie *trie)
+{
+    size_t i, j, size;
+    uint32_t edges = 0, matched = 0, full = 0, chain = 0;
+    ACT_NODE_t *node;
+    ACT_NODE_t **nodes;
+    char *in_chain;
+    struct acf_state *s;
+    AC_FLAT_t *thiz;
+
+    if (!(nodes = ac_flat_enumerate (trie, &size)))
+        return NULL;
+
+    if (!(in_chain = (char *) calloc (size, 1)) 
+            || !(thiz = (AC_FLAT_t *) calloc (1, sizeof(AC_FLAT_t))))
+    {
+        free (in_chain);
+        free (nodes);
+        return NULL;
+    }
+
+    /* A single child directly follows its parent. Each run of chain states
+     * is closed by an end slot. */
+    for (i = 1; i < size; i++)
+    {
+        node = nodes[i];
+        in_chain[i] = i > 1 && node->outgoing_size == 1 && !node->matched_size
+                && !node->output_node && nodes[i - 1]->outgoing_size == 1 
+                && nodes[i - 1]->outgoing[0].next == node;
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        if (!in_chain[i])
+        {
+            thiz->states_size++;
+            thiz->edges_size += nodes[i]->outgoing_size;
+            thiz->matched_size += nodes[i]->matched_size;
+        }
+        else 
+        {
+            thiz->chains_size++;
+            if (i + 1 == size || !in_chain[i + 1])
+                thiz->chains_size++;
+        }
+    }
+
+    /* State numbers must leave room for the end slot mark */
+    if ((size_t) thiz->states_size + thiz->chains_size >= ACF_CHAIN_END)
+    {
+        free (in_chain);
+        free (nodes);
+        ac_flat_release (thiz);
+        return NULL;
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        if (!in_chain[i])
+            nodes[i]->state = full++;
+        else
+        {
+            nodes[i]->state = thiz->states_size + chain++;
+            if (i + 1 == size || !in_chain[i + 1])
+                chain++;
+        }
+    }
+
+    thiz->states = (struct acf_state *) malloc
+            (thiz->states_size * sizeof(struct acf_state));
+    thiz->alphas = (AC_ALPHABET_t *) calloc
+            (thiz->edges_size + ACF_ALPHAS_PADDING, sizeof(AC_ALPHABET_t));
+    thiz->nexts = (uint32_t *) malloc
+            ((thiz->edges_size + 1) * sizeof(uint32_t));
+    thiz->matched = (AC_PATTERN_t *) malloc
+            ((thiz->matched_size + 1) * sizeof(AC_PATTERN_t));
+    thiz->chain_failures = (uint32_t *) malloc
+            ((thiz->chains_size + 1) * sizeof(uint32_t));
+    thiz->chain_alphas = (AC_ALPHABET_t *) calloc
+            (thiz->chains_size + 1, sizeof(AC_ALPHABET_t));
+
+    if (!thiz->states || !thiz->alphas || !thiz->nexts || !thiz->matched
+            || !thiz->chain_failures || !thiz->chain_alphas)
+    {
+        free (in_chain);
+        free (nodes);
+        ac_flat_release (thiz);
+        return NULL;
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        node = nodes[i];
+
+        if (in_chain[i])
+        {
+            chain = node->state - thiz->states_size;
+            thiz->chain_failures[chain] = node->failure_node 
+                    ? node->failure_node->state : ACF_ROOT;
+            thiz->chain_alphas[chain] = node->outgoing[0].alpha;
+
+            if (i + 1 == size || !in_chain[i + 1])
+                thiz->chain_failures[chain + 1] = 
+                        node->outgoing[0].next->state | ACF_CHAIN_END;
+            continue;
+        }
+
+        s = &thiz->states[node->state];
+
+        s->failure = node->failure_node ? node->failure_node->state : ACF_ROOT;
+        s->output = node->output_node ? node->output_node->state : ACF_ROOT;
+
+        s->edges = edges;
+        s->edges_size = node->outgoing_size;
+        for (j = 0; j < node->outgoing_size; j++, edges++)
+        {
+            thiz->alphas[edges] = node->outgoing[j].alpha;
+            thiz->nexts[edges] = node->outgoing[j].next->state;
+        }
+
+        s->matched = matched;
+        s->matched_size = node->matched_size;
+        if (node->matched_size)
+            memcpy (&thiz->matched[matched], node->matched,
+                    node->matched_size * sizeof(AC_PATTERN_t));
+        matched += node->matched_size;
+
+        /* The run of a single edge covers the chain states behind it */
+        s->run = 0;
+        if (node->outgoing_size == 1)
+            for (s->run = 1; i + s->run < size && in_chain[i + s->run]; )
+                s->run++;
+    }
+
+    for (i = 0; i < 256; i++)
+        thiz->root_nexts[i] = ac_flat_find (thiz, ACF_ROOT, (AC_ALPHABET_t) i);
+
+#ifdef ACF_HAVE_AVX2
+    __builtin_cpu_init ();
+    thiz->avx2 = __builtin_cpu_supports ("avx2");
+#endif
+
+    free (in_chain);
+    free (nodes);
+    return thiz;
+}
+
+/**
+ * @brief Finds the outgoing edge of a state with up to ACF_WIDE_EDGES edges
+ * using AVX2. Only called if the CPU supports it.
+ *
+ * @return The target state, or ACF_ROOT if there is no such edge
+ *****************************************************************************/
+#ifdef ACF_HAVE_AVX2
+__attribute__((target("avx2")))
+#endif
+uint32_t ac_flat_find_wide (const AC_FLAT_t *thiz, 
+        const struct acf_state *s, AC_ALPHABET_t alpha)
+{
+#ifdef ACF_HAVE_AVX2
+    __m256i labels = _mm256_loadu_si256 
+            ((const __m256i *) &thiz->alphas[s->edges]);
+    uint64_t mask = (uint32_t) _mm256_movemask_epi8 (
+            _mm256_cmpeq_epi8 (labels, _mm256_set1_epi8 (alpha)));
+
+    mask &= ((uint64_t) 1 << s->edges_size) - 1;
+    return mask ? thiz->nexts[s->edges + __builtin_ctz ((uint32_t) mask)] 
+                : ACF_ROOT;
+#else
+    uint32_t i;
+
+    for (i = 0; i < s->edges_size; i++)
+        if (thiz->alphas[s->edges + i] == alpha)
+            return thiz->nexts[s->edges + i];
+    return ACF_ROOT;
+#endif
+}
+
+/**
+ * @brief Precomputes the complete transition table of the flattened trie
+ *
+ * Two bytes fall into the same equivalence class if the trie can not tell
+ * them apart. In a trie that is the case exactly when neither of them labels
+ * any edge, so every byte used by the patterns gets a class of its own and
+ * all other bytes share class 0.
+ *
+ * @param thiz pointer to the flattened trie
+ * @param max_size the maximum size of the table in bytes
+ * @return 1 if the table was built, 0 if it would exceed @p max_size
+ *****************************************************************************/
+int ac_flat_make_dfa (AC_FLAT_t *thiz, size_t max_size)
+{
+    uint32_t i, c, k, next, head, tail, failure;
+    uint32_t *row, *queue;
+    const struct acf_state *s;
+    size_t size = (size_t) thiz->states_size + thiz->chains_size;
+    AC_ALPHABET_t alpha;
+    /* A byte of each class. There are up to 257 classes, as class 0 stays
+     * in use even when every byte labels an edge. */
+    AC_ALPHABET_t reps[257];
+
+    if (thiz->delta)
+        return 1;
+
+    memset (thiz->classes, 0, sizeof(thiz->classes));
+    thiz->classes_size = 1;
+
+    /* The labels of the full states come first, then those of the chain 
+     * states, where the end slots carry none */
+    for (i = 0; i < thiz->edges_size + thiz->chains_size; i++)
+    {
+        if (i < thiz->edges_size)
+            alpha = thiz->alphas[i];
+        else if (thiz->chain_failures[i - thiz->edges_size] & ACF_CHAIN_END)
+            continue;
+        else
+            alpha = thiz->chain_alphas[i - thiz->edges_size];
+
+        c = (unsigned char) alpha;
+        if (!thiz->classes[c])
+        {
+            reps[thiz->classes_size] = alpha;
+            thiz->classes[c] = thiz->classes_size++;
+        }
+    }
+
+    /* End slots get rows, too, which stay unused */
+    if (size * thiz->classes_size * sizeof(uint32_t) > max_size)
+        return 0;
+
+    thiz->delta = (uint32_t *) malloc
+            (size * thiz->classes_size * sizeof(uint32_t));
+    queue = (uint32_t *) malloc (size * sizeof(uint32_t));
+    if (!thiz->delta || !queue)
+    {
+        free (thiz->delta);
+        free (queue);
+        thiz->delta = NULL;
+        return 0;
+    }
+
+    /* Filling the rows in breadth-first order guarantees that the row of the
+     * failure state is complete before it is needed. Class 0 never has an
+     * edge, so it always leads back to the root. */
+    head = tail = 0;
+    queue[tail++] = ACF_ROOT;
+
+    while (head < tail)
+    {
+        i = queue[head++];
+        if (i >= thiz->states_size)
+            queue[tail++] = ac_flat_chain_next (thiz, i - thiz->states_size);
+        else
+        {
+            s = &thiz->states[i];
+            for (k = 0; k < s->edges_size; k++)
+                queue[tail++] = thiz->nexts[s->edges + k];
+        }
+        failure = ac_flat_failure (thiz, i);
+
+        row = &thiz->delta[(size_t) i * thiz->classes_size];
+        row[0] = ACF_ROOT;
+
+        for (k = 1; k < thiz->classes_size; k++)
+        {
+            next = ac_flat_find (thiz, i, reps[k]);
+            if (next == ACF_ROOT && i != ACF_ROOT)
+                next = thiz->delta[(size_t) failure * thiz->classes_size + k];
+            row[k] = next;
+        }
+    }
+
+    free (queue);
+    return 1;
+}
+
+/**
+ * @brief Copies the texts and string ids of the matched patterns into a
+ * buffer of the flattened trie, so they stay valid once the memory pool of 
+ * the trie is gone.
+ *
+ * @param thiz pointer to the flattened trie
+ * @return 1 on success, 0 if memory could not be allocated
+ *****************************************************************************/
+int ac_flat_own_texts (AC_FLAT_t *thiz)
+{
+    uint32_t i;
+    size_t size = 0;
+    AC_PATTERN_t *patt;
+    AC_ALPHABET_t *text;
+
+    if (thiz->texts)
+        return 1;
+
+    for (i = 0; i < thiz->matched_size; i++)
+    {
+        patt = &thiz->matched[i];
+        size += patt->ptext.length + patt->rtext.length;
+        if (patt->id.type == AC_PATTID_TYPE_STRING)
+            size += strlen (patt->id.u.stringy) + 1;
+    }
+
+    if (!(thiz->texts = (AC_ALPHABET_t *) malloc (size + 1)))
+        return 0;
+
+    text = thiz->texts;
+
+    for (i = 0; i < thiz->matched_size; i++)
+    {
+        patt = &thiz->matched[i];
+
+        memcpy (text, patt->ptext.astring, patt->ptext.length);
+        patt->ptext.astring = text;
+        text += patt->ptext.length;
+
+        if (patt->rtext.astring)
+        {
+            memcpy (text, patt->rtext.astring, patt->rtext.length);
+            patt->rtext.astring = text;
+            text += patt->rtext.length;
+        }
+
+        if (patt->id.type == AC_PATTID_TYPE_STRING)
+        {
+            size = strlen (patt->id.u.stringy) + 1;
+            memcpy (text, patt->id.u.stringy, size);
+            patt->id.u.stringy = text;
+            text += size;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Release all allocated memories to the flattened trie
+ *
+ * @param thiz pointer to the flattened trie
+ *****************************************************************************/
+void ac_flat_release (AC_FLAT_t *thiz)
+{
+    if (!thiz)
+        return;
+
+    free (thiz->states);
+    free (thiz->alphas);
+    free (thiz->nexts);
+    free (thiz->matched);
+    free (thiz->chain_failures);
+    free (thiz->chain_alphas);
+    free (thiz->texts);
+    free (thiz->delta);
+    free (thiz);
+}
+
+/**
+ * @brief Lists all nodes of the trie and assigns each node its state index.
+ *
+ * Branching nodes are expanded in breadth-first order, so the shallow states
+ * that are visited most often are packed together at the front of the table.
+ * A node with a single child, however, is immediately followed by that child,
+ * which makes every chain a block of consecutive states.
+ *
+ * @param trie pointer to the trie
+ * @param size receives the number of nodes
+ * @return An array of the nodes which the caller must free
+ *****************************************************************************/
+static ACT_NODE_t **ac_flat_enumerate (struct ac_trie *trie, size_t *size)
+{
+    size_t i, head = 0, tail = 0;
+    size_t capacity = 256;
+    ACT_NODE_t *node;
+    ACT_NODE_t **nodes;
+
+    if (!(nodes = (ACT_NODE_t **) malloc (capacity * sizeof(ACT_NODE_t *))))
+        return NULL;
+
+    if (!ac_flat_place_chain (&nodes, &tail, &capacity, trie->root))
+        return NULL;
+
+    while (head < tail)
+    {
+        node = nodes[head++];
+
+        /* The only child of a chain node has already been placed */
+        if (node->outgoing_size == 1)
+            continue;
+
+        for (i = 0; i < node->outgoing_size; i++)
+            if (!ac_flat_place_chain (&nodes, &tail, &capacity, 
+                    node->outgoing[i].next))
+                return NULL;
+    }
+
+    *size = tail;
+    return nodes;
+}
+
+/**
+ * @brief Appends @p node to the node list, followed by the chain of single
+ * children that hangs off it.
+ *
+ * @return 1 on success, 0 if memory could not be allocated, in which case the
+ * node list has been freed
+ *****************************************************************************/
+static int ac_flat_place_chain (ACT_NODE_t ***nodes, size_t *size, 
+        size_t *capacity, ACT_NODE_t *node)
+{
+    ACT_NODE_t **grown;
+
+    for (;;)
+    {
+        if (*size == *capacity)
+        {
+            *capacity *= 2;
+            grown = (ACT_NODE_t **) realloc 
+                    (*nodes, *capacity * sizeof(ACT_NODE_t *));
+            if (!grown)
+            {
+                free (*nodes);
+                return 0;
+            }
+            *nodes = grown;
+        }
+
+        node->state = *size;
+        (*nodes)[(*size)++] = node;
+
+        if (node->outgoing_size != 1)
+            return 1;
+        node = node->outgoing[0].next;
+    }
+}
@@ -0,0 +1,402 @@
+/*
+ * flat.h: Defines the flattened, array based form of a finalized trie
+ * This file is part of multifast.
+ *
+ * See the file "COPYING" in the main distribution directory for copyright.
+ *
+ * After finalization the pointer based trie (act_node) is compacted into
+ * a single table of states. States refer to each other by 32-bit indices,
+ * and the outgoing edges of all states are stored back to back, so searching
+ * touches a few dense arrays rather than heap-scattered nodes.
+ *
+ * Long patterns turn into chains of nodes with a single edge each. Only the
+ * first node of a chain becomes a full state. The nodes after it, up to the
+ * next one that branches or reports a match, are stored as a run: their
+ * edge labels form an inline string of bytes, and each keeps just its
+ * failure transition. These chain states are numbered after the full
+ * states, consecutively along the run, which is closed by an end slot
+ * holding the state the run leads to. The search compares the text against
+ * a whole run at once and only falls back to single transitions where the
+ * text leaves the chain. Since every byte of a run is still a state with a
+ * failure transition of its own, failures out of the middle of a chain stay
+ * exact.
+ *
+ * Optionally the table can be completed into a full DFA: every state then
+ * holds a transition for every input byte, so the search never follows a
+ * failure transition. To bound its size, that table is indexed by byte
+ * equivalence classes rather than by the bytes themselves.
+ *
+ * In the sparse form, the labels of a state with up to ACF_PACKED_EDGES edges
+ * are compared against the input byte all at once with SSE2, and states with
+ * up to ACF_WIDE_EDGES edges use AVX2 where the CPU supports it. Larger
+ * states fall back to a binary search. The root state, which is entered on
+ * nearly every failure, has a direct 256-entry transition table.
+*/
+
+#ifndef _AC_FLAT_H_
+#define _AC_FLAT_H_
+
+#include <stdint.h>
+#include "actypes.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ACF_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Forward declaration */
+struct ac_trie;
+
+/**
+ * The root state. Since no edge ever leads back to the root, 0 is also used
+ * as the "no transition" value of the edge lookup.
+ */
+#define ACF_ROOT 0
+
+/**
+ * States with up to this many edges are searched with a single SSE2 compare
+ * (or a short linear scan on hosts without SSE2)
+ */
+#define ACF_PACKED_EDGES 16
+
+/**
+ * States with up to this many edges are searched with a single AVX2 compare
+ * if the CPU supports it
+ */
+#define ACF_WIDE_EDGES 32
+
+/**
+ * The edge label array is padded by this many bytes, so vector loads at the
+ * last state never read past the allocation
+ */
+#define ACF_ALPHAS_PADDING 32
+
+/**
+ * Runs shorter than this are left to the plain transition
+ */
+#define ACF_MIN_RUN 2
+
+/**
+ * Marks the entry of the end slot of a run, which holds the state that the
+ * last edge of the run leads to instead of a failure transition
+ */
+#define ACF_CHAIN_END 0x80000000u
+
+/**
+ * A state of the flattened trie
+ */
+struct acf_state
+{
+    uint32_t failure;       /**< The failure transition state */
+    uint32_t edges;         /**< Index of the first outgoing edge */
+    uint32_t matched;       /**< Index of the first pattern accepted by the 
+                             * state itself */
+    uint32_t output;        /**< The next state on the failure chain that 
+                             * accepts patterns, or ACF_ROOT if none */
+    uint16_t edges_size;    /**< Number of outgoing edges */
+    uint16_t matched_size;  /**< Number of patterns accepted by the state */
+    uint32_t run;           /**< If the state has a single edge, the number
+                             * of bytes up to the end of the run of chain
+                             * states it leads into, its own edge included;
+                             * 0 otherwise */
+};
+
+/**
+ * The flattened trie
+ */
+typedef struct ac_flat
+{
+    struct acf_state *states;   /**< Full states */
+    uint32_t states_size;       /**< Number of full states; chain states
+                                 * are numbered from here on */
+
+    uint32_t *chain_failures;   /**< Failure transition of every chain 
+                                 * state, followed by the end slot of its
+                                 * run */
+    AC_ALPHABET_t *chain_alphas;/**< Label of the single edge of every chain
+                                 * state, which leads to the next one */
+    uint32_t chains_size;       /**< Number of chain states and end slots */
+
+    AC_ALPHABET_t *alphas;      /**< Edge labels; sorted within each state */
+    uint32_t *nexts;            /**< Edge targets; parallel to alphas */
+    uint32_t edges_size;        /**< Total number of edges */
+
+    uint32_t root_nexts[256];   /**< Complete transition table of the root */
+    int avx2;                   /**< Whether the CPU supports AVX2 */
+
+    AC_PATTERN_t *matched;      /**< Accepted patterns of all states */
+    uint32_t matched_size;      /**< Total number of matched patterns */
+    AC_ALPHABET_t *texts;       /**< Texts and ids of the matched patterns;
+                                 * NULL while they still live in the trie */
+
+    uint16_t classes[256];      /**< Equivalence class of every byte */
+    uint32_t classes_size;      /**< Number of equivalence classes */
+    uint32_t *delta;            /**< Complete transition table indexed by
+                                 * state and class, with rows for the full
+                                 * and the chain states; NULL if not built */
+
+} AC_FLAT_t;
+
+AC_FLAT_t *ac_flat_create (struct ac_trie *trie);
+int  ac_flat_make_dfa (AC_FLAT_t *thiz, size_t max_size);
+int  ac_flat_own_texts (AC_FLAT_t *thiz);
+void ac_flat_release (AC_FLAT_t *thiz);
+
+uint32_t ac_flat_find_wide (const AC_FLAT_t *thiz, 
+        const struct acf_state *s, AC_ALPHABET_t alpha);
+
+/**
+ * @brief Returns the index of the lowest set bit of a non-zero @p mask
+ *****************************************************************************/
+static inline unsigned int ac_flat_ctz (unsigned int mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward (&index, mask);
+    return (unsigned int) index;
+#else
+    return (unsigned int) __builtin_ctz (mask);
+#endif
+}
+
+/**
+ * @brief Hints the CPU to start loading the data needed to leave @p state,
+ * so the cache miss overlaps with other work.
+ *****************************************************************************/
+static inline void ac_flat_prefetch (const AC_FLAT_t *thiz, uint32_t state)
+{
+    const void *p = thiz->delta 
+            ? (const void *) &thiz->delta[(size_t) state * thiz->classes_size]
+            : state >= thiz->states_size
+            ? (const void *) &thiz->chain_alphas[state - thiz->states_size]
+            : (const void *) &thiz->states[state];
+#if defined(__GNUC__)
+    __builtin_prefetch (p);
+#elif defined(ACF_HAVE_SSE2)
+    _mm_prefetch ((const char *) p, _MM_HINT_T0);
+#else
+    (void) p;
+#endif
+}
+
+/**
+ * @brief Hints the CPU to start loading the edges of @p state. Only useful 
+ * for the sparse form, once the state itself has been loaded.
+ *****************************************************************************/
+static inline void ac_flat_prefetch_edges (const AC_FLAT_t *thiz, uint32_t state)
+{
+#if defined(__GNUC__)
+    const struct acf_state *s;
+    if (state >= thiz->states_size)
+        return;
+    s = &thiz->states[state];
+    __builtin_prefetch (&thiz->alphas[s->edges]);
+    __builtin_prefetch (&thiz->nexts[s->edges]);
+#elif defined(ACF_HAVE_SSE2)
+    const struct acf_state *s;
+    if (state >= thiz->states_size)
+        return;
+    s = &thiz->states[state];
+    _mm_prefetch ((const char *) &thiz->alphas[s->edges], _MM_HINT_T0);
+    _mm_prefetch ((const char *) &thiz->nexts[s->edges], _MM_HINT_T0);
+#else
+    (void) thiz;
+    (void) state;
+#endif
+}
+
+/**
+ * @brief Returns the state the edge of chain state @p chain leads to, 
+ * given as an index into the chains
+ *****************************************************************************/
+static inline uint32_t ac_flat_chain_next (const AC_FLAT_t *thiz, uint32_t chain)
+{
+    uint32_t end = thiz->chain_failures[chain + 1];
+
+    return end & ACF_CHAIN_END 
+            ? end & ~ACF_CHAIN_END : thiz->states_size + chain + 1;
+}
+
+/**
+ * @brief Returns the failure transition state of @p state
+ *****************************************************************************/
+static inline uint32_t ac_flat_failure (const AC_FLAT_t *thiz, uint32_t state)
+{
+    return state >= thiz->states_size 
+            ? thiz->chain_failures[state - thiz->states_size]
+            : thiz->states[state].failure;
+}
+
+/**
+ * @brief Returns the first state that accepts patterns on the output chain 
+ * of @p state, starting with @p state itself, or ACF_ROOT if there is none.
+ * Chain states report nothing, so all states on the output chain are full
+ * states.
+ *****************************************************************************/
+static inline uint32_t ac_flat_first_output (const AC_FLAT_t *thiz, uint32_t state)
+{
+    const struct acf_state *s;
+
+    if (state >= thiz->states_size)
+        return ACF_ROOT;
+
+    s = &thiz->states[state];
+    return s->matched_size ? state : s->output;
+}
+
+/**
+ * @brief Finds the target of the outgoing edge of @p state labeled @p alpha
+ *
+ * @return The target state, or ACF_ROOT if there is no such edge
+ *****************************************************************************/
+static inline uint32_t ac_flat_find
+    (const AC_FLAT_t *thiz, uint32_t state, AC_ALPHABET_t alpha)
+{
+    const struct acf_state *s;
+    const AC_ALPHABET_t *alphas;
+    int min = 0;
+    int max;
+    int mid;
+
+    if (state >= thiz->states_size)
+    {
+        state -= thiz->states_size;
+        return thiz->chain_alphas[state] == alpha 
+                ? ac_flat_chain_next (thiz, state) : ACF_ROOT;
+    }
+
+    s = &thiz->states[state];
+    alphas = &thiz->alphas[s->edges];
+    max = (int) s->edges_size - 1;
+
+    if (s->edges_size <= ACF_PACKED_EDGES)
+    {
+#ifdef ACF_HAVE_SSE2
+        __m128i labels = _mm_loadu_si128 ((const __m128i *) alphas);
+        unsigned int mask = (unsigned int) _mm_movemask_epi8 (
+                _mm_cmpeq_epi8 (labels, _mm_set1_epi8 (alpha)));
+
+        mask &= (1u << s->edges_size) - 1;
+        return mask ? thiz->nexts[s->edges + ac_flat_ctz (mask)] : ACF_ROOT;
+#else
+        for (mid = 0; mid <= max; mid++)
+            if (alphas[mid] == alpha)
+                return thiz->nexts[s->edges + mid];
+        return ACF_ROOT;
+#endif
+    }
+
+    if (s->edges_size <= ACF_WIDE_EDGES && thiz->avx2)
+        return ac_flat_find_wide (thiz, s, alpha);
+
+    while (min <= max)
+    {
+        mid = (min + max) >> 1;
+        if (alpha > alphas[mid])
+            min = mid + 1;
+        else if (alpha < alphas[mid])
+            max = mid - 1;
+        else
+            return thiz->nexts[s->edges + mid];
+    }
+    return ACF_ROOT;
+}
+
+/**
+ * @brief Makes the transition from @p state on @p alpha, following failure
+ * transitions as needed.
+ *
+ * @return The next state
+ *****************************************************************************/
+static inline uint32_t ac_flat_next
+    (const AC_FLAT_t *thiz, uint32_t state, AC_ALPHABET_t alpha)
+{
+    uint32_t next;
+
+    if (thiz->delta)
+        return thiz->delta[(size_t) state * thiz->classes_size 
+                + thiz->classes[(unsigned char) alpha]];
+
+    while (state != ACF_ROOT)
+    {
+        if ((next = ac_flat_find (thiz, state, alpha)) != ACF_ROOT)
+            return next;
+        state = ac_flat_failure (thiz, state);
+    }
+    return thiz->root_nexts[(unsigned char) alpha];
+}
+
+/**
+ * @brief Follows the single edge of the full state @p state and the run of
+ * chain states it leads into for as long as they agree with @p text, 
+ * comparing 16 bytes at a time.
+ *
+ * No state passed on the way reports a match, except possibly the one the
+ * run ends in. Runs shorter than ACF_MIN_RUN, and runs entered through a
+ * chain state, are left to single transitions.
+ *
+ * @param state the current state; receives the state reached
+ * @param text the remaining input; must not be empty
+ * @param length the length of @p text
+ * @return The number of bytes consumed; 0 if the run was not entered
+ *****************************************************************************/
+static inline size_t ac_flat_follow_run (const AC_FLAT_t *thiz, 
+        uint32_t *state, const AC_ALPHABET_t *text, size_t length)
+{
+    const struct acf_state *s;
+    const AC_ALPHABET_t *labels;
+    uint32_t first;
+    size_t size, i = 0;
+#ifdef ACF_HAVE_SSE2
+    unsigned int mask;
+#endif
+
+    if (*state >= thiz->states_size)
+        return 0;
+
+    s = &thiz->states[*state];
+    if (s->run < ACF_MIN_RUN || thiz->alphas[s->edges] != text[0])
+        return 0;
+
+    /* The state's own edge matched; the rest of the run is inline */
+    first = thiz->nexts[s->edges] - thiz->states_size;
+    labels = &thiz->chain_alphas[first];
+    text++;
+    size = s->run - 1 < length - 1 ? s->run - 1 : length - 1;
+
+#ifdef ACF_HAVE_SSE2
+    for (; i + 16 <= size; i += 16)
+    {
+        mask = (unsigned int) _mm_movemask_epi8 (_mm_cmpeq_epi8 (
+                _mm_loadu_si128 ((const __m128i *) &labels[i]),
+                _mm_loadu_si128 ((const __m128i *) &text[i])));
+        if (mask != 0xFFFF)
+        {
+            i += ac_flat_ctz (~mask);
+            break;
+        }
+    }
+#endif
+    /* Stops right away at a mismatch the vector compare found */
+    while (i < size && labels[i] == text[i])
+        i++;
+
+    *state = i == s->run - 1 
+            ? thiz->chain_failures[first + i] & ~ACF_CHAIN_END
+            : thiz->states_size + first + (uint32_t) i;
+    return i + 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -30,10 +30,6 @@
 #error "MPOOL_BLOCK_SIZE must be multiple 16"
 #endif
 
-#if (MPOOL_BLOCK_SIZE <= AC_PATTRN_MAX_LENGTH)
-#error "MPOOL_BLOCK_SIZE must be bigger than AC_PATTRN_MAX_LENGTH"
-#endif
-
 struct mpool_block
 {
     size_t size;
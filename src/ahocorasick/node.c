@@ -62,6 +62,7 @@ static void node_init (ACT_NODE_t *thiz)
     
     thiz->final = 0;
     thiz->failure_node = NULL;
+    thiz->output_node = NULL;
     thiz->depth = 0;
     
     thiz->matched = NULL;
@@ -330,8 +331,9 @@ void node_sort_edges (ACT_NODE_t *nod)
 /**
  * @brief Bookmarks the to-be-replaced patterns
  * 
- * If there was more than one pattern accepted in a node then only one of them
- * must be replaced: The longest pattern that has a requested replacement.
+ * If there was more than one pattern accepted in a node (directly or through 
+ * its output links) then only one of them must be replaced: The longest 
+ * pattern that has a requested replacement.
  * 
  * @param node
  * @return 1 if there was any replacement, 0 otherwise
@@ -339,22 +341,23 @@ void node_sort_edges (ACT_NODE_t *nod)
 int node_book_replacement (ACT_NODE_t *nod)
 {
     size_t j;
+    ACT_NODE_t *n;
     AC_PATTERN_t *pattern;
     AC_PATTERN_t *longest = NULL;
     
-    if(!nod->final)
-        return 0;
-
-    for (j=0; j < nod->matched_size; j++)
+    for (n = nod->final ? nod : nod->output_node; n; n = n->output_node)
     {
-        pattern = &nod->matched[j];
-        
-        if (pattern->rtext.astring != NULL)
+        for (j=0; j < n->matched_size; j++)
         {
-            if (!longest)
-                longest = pattern;
-            else if (pattern->ptext.length > longest->ptext.length)
-                longest = pattern;
+            pattern = &n->matched[j];
+            
+            if (pattern->rtext.astring != NULL)
+            {
+                if (!longest)
+                    longest = pattern;
+                else if (pattern->ptext.length > longest->ptext.length)
+                    longest = pattern;
+            }
         }
     }
     
@@ -416,30 +419,22 @@ static void node_grow_matched_vector (ACT_NODE_t *thiz)
 }
 
 /**
- * @brief Collect accepted patterns of the node.
+ * @brief Links the node to the nearest final node on its failure chain.
  * 
- * The accepted patterns consist of the node's own accepted pattern plus 
- * accepted patterns of its failure node.
+ * The patterns matched at a node are its own accepted patterns plus those of
+ * every final node on its failure chain. Rather than copying all of them 
+ * into each node, a node only keeps its own patterns and the output link, 
+ * and the search follows the output links when reporting a match. The 
+ * failure node must already be linked.
  * 
  * @param node
  *****************************************************************************/
-void node_collect_matches (ACT_NODE_t *nod)
+void node_link_output (ACT_NODE_t *nod)
 {
-    size_t i;
-    ACT_NODE_t *n = nod;
+    ACT_NODE_t *n = nod->failure_node;
     
-    while ((n = n->failure_node))
-    {
-        for (i = 0; i < n->matched_size; i++)
-            /* Always call with copy parameter 0 */
-            node_accept_pattern (nod, &(n->matched[i]), 0);
-        
-        if (n->final)
-            nod->final = 1;
-    }
-    
-    node_sort_edges (nod);
-    /* Sort matched patterns? Is that necessary? I don't think so. */
+    if (n)
+        nod->output_node = n->final ? n : n->output_node;
 }
 
 /**
@@ -460,6 +455,9 @@ void node_display (ACT_NODE_t *nod)
     else
         printf ("N.A.\n");
     
+    if (nod->output_node)
+        printf("         \\..output..> NODE(%3d)\n", nod->output_node->id);
+    
     for (j = 0; j < nod->outgoing_size; j++)
     {
         e = &nod->outgoing[j];
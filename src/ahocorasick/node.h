@@ -41,12 +41,15 @@ typedef struct act_node
     int final;      /**< A final node accepts pattern; 0: not, 1: is final */
     size_t depth;   /**< Distance between this node and the root */
     struct act_node *failure_node;  /**< The failure transition node */
+    struct act_node *output_node;   /**< The nearest final node on the failure
+                                     * chain; its patterns match wherever this
+                                     * node's do */
     
     struct act_edge *outgoing;  /**< Outgoing edges array */
     size_t outgoing_capacity;   /**< Max capacity of outgoing edges */
     size_t outgoing_size;       /**< Number of outgoing edges */
     
-    AC_PATTERN_t *matched;      /**< Matched patterns array */
+    AC_PATTERN_t *matched;      /**< Patterns accepted by the node itself */
     size_t matched_capacity;    /**< Max capacity of the matched patterns */
     size_t matched_size;        /**< Number of matched patterns in this node */
     
@@ -55,6 +58,8 @@ typedef struct act_node
     
     struct ac_trie *trie;    /**< The trie that this node belongs to */
     
+    unsigned int state;     /**< Index of the node in the flattened trie */
+    
 } ACT_NODE_t;
 
 /**
@@ -79,7 +84,7 @@ void node_assign_id (ACT_NODE_t *nod);
 void node_add_edge (ACT_NODE_t *nod, ACT_NODE_t *next, AC_ALPHABET_t alpha);
 void node_sort_edges (ACT_NODE_t *nod);
 void node_accept_pattern (ACT_NODE_t *nod, AC_PATTERN_t *new_patt, int copy);
-void node_collect_matches (ACT_NODE_t *nod);
+void node_link_output (ACT_NODE_t *nod);
 void node_release_vectors (ACT_NODE_t *nod);
 int  node_book_replacement (ACT_NODE_t *nod);
 void node_display (ACT_NODE_t *nod);
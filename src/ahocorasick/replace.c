@@ -51,7 +51,7 @@ static void mf_repdata_savetobacklog
 static void mf_repdata_flush 
     (MF_REPLACEMENT_DATA_t *rd);
 
-static unsigned int mf_repdata_bookreplacements 
+static int mf_repdata_bookreplacements 
     (ACT_NODE_t *node);
 
 /* Publics */
@@ -59,7 +59,7 @@ static unsigned int mf_repdata_bookreplacements
 void mf_repdata_init (AC_TRIE_t *trie);
 void mf_repdata_reset (MF_REPLACEMENT_DATA_t *rd);
 void mf_repdata_release (MF_REPLACEMENT_DATA_t *rd);
-void mf_repdata_allocbuf (MF_REPLACEMENT_DATA_t *rd);
+int  mf_repdata_allocbuf (MF_REPLACEMENT_DATA_t *rd);
 
 
 /**
@@ -91,43 +91,84 @@ void mf_repdata_init (AC_TRIE_t *trie)
  * Must be called when finalizing the trie itself
  * 
  * @param rd
+ * @return 1 on success, 0 if memory could not be allocated
  *****************************************************************************/
-void mf_repdata_allocbuf (MF_REPLACEMENT_DATA_t *rd)
+int mf_repdata_allocbuf (MF_REPLACEMENT_DATA_t *rd)
 {    
     /* Bookmark replacement pattern for faster retrieval */
-    rd->has_replacement = mf_repdata_bookreplacements (rd->trie->root);
+    int booked = mf_repdata_bookreplacements (rd->trie->root);
+    
+    if (booked < 0)
+        return 0;
+    
+    rd->has_replacement = booked;
     
     if (rd->has_replacement)
     {
         rd->buffer.astring = (AC_ALPHABET_t *) 
                 malloc (MF_REPLACEMENT_BUFFER_SIZE * sizeof(AC_ALPHABET_t));
         
+        /* Backlog length is not bigger than the max pattern length */
         rd->backlog.astring = (AC_ALPHABET_t *) 
-                malloc (AC_PATTRN_MAX_LENGTH * sizeof(AC_ALPHABET_t));
+                malloc ((rd->trie->longest_pattern + 1) * sizeof(AC_ALPHABET_t));
         
-        /* Backlog length is not bigger than the max pattern length */
+        if (!rd->buffer.astring || !rd->backlog.astring)
+        {
+            free ((AC_ALPHABET_t *) rd->buffer.astring);
+            free ((AC_ALPHABET_t *) rd->backlog.astring);
+            rd->buffer.astring = NULL;
+            rd->backlog.astring = NULL;
+            return 0;
+        }
     }
+    
+    return 1;
 }
 
 /**
  * @brief Bookmarks the to-be-replaced patterns for all nodes
  * 
  * @param node
- * @return 
+ * @return The number of nodes with replacements, or -1 if memory could not 
+ * be allocated
  *****************************************************************************/
-static unsigned int mf_repdata_bookreplacements (ACT_NODE_t *node)
+static int mf_repdata_bookreplacements (ACT_NODE_t *node)
 {
-    size_t i;
-    unsigned int ret;
-    
-    ret = node_book_replacement (node);
-    
-    for (i = 0; i < node->outgoing_size; i++)
+    size_t i, size = 0;
+    size_t capacity = 256;
+    int ret = 0;
+    ACT_NODE_t **stack, **grown;
+    
+    /* Walk the trie with an explicit stack rather than recursion, since 
+     * patterns and thus the depth of the trie are not limited in length */
+    if (!(stack = (ACT_NODE_t **) malloc (capacity * sizeof(ACT_NODE_t *))))
+        return -1;
+    stack[size++] = node;
+    
+    while (size)
     {
-        /* Recursively call itself to traverse all nodes */
-        ret += mf_repdata_bookreplacements (node->outgoing[i].next);
+        node = stack[--size];
+        ret += node_book_replacement (node);
+        
+        if (size + node->outgoing_size > capacity)
+        {
+            while (size + node->outgoing_size > capacity)
+                capacity *= 2;
+            grown = (ACT_NODE_t **) realloc 
+                    (stack, capacity * sizeof(ACT_NODE_t *));
+            if (!grown)
+            {
+                free (stack);
+                return -1;
+            }
+            stack = grown;
+        }
+        
+        for (i = 0; i < node->outgoing_size; i++)
+            stack[size++] = node->outgoing[i].next;
     }
     
+    free (stack);
     return ret;
 }
 
@@ -477,8 +518,8 @@ int multifast_replace (AC_TRIE_t *thiz, AC_TEXT_t *instr,
     size_t position_r = 0;  /* Relative current position in the input string */
     size_t backlog_pos = 0; /* Relative backlog position in the input string */
     
-    if (thiz->trie_open)
-        return -1; /* _finalize() must be called first */
+    if (thiz->trie_open || !thiz->root)
+        return -1; /* _finalize() must be called first, and the nodes kept */
     
     if (!rd->has_replacement)
         return -2; /* Trie doesn't have any to-be-replaced pattern */
@@ -511,7 +552,7 @@ int multifast_replace (AC_TRIE_t *thiz, AC_TEXT_t *instr,
             position_r++;
         }
         
-        if (current->final && next)
+        if ((current->final || current->output_node) && next)
         {
             /* Bookmark nominee patterns for replacement */
             nom.pattern = current->to_be_replaced;
@@ -552,6 +593,9 @@ int multifast_replace (AC_TRIE_t *thiz, AC_TEXT_t *instr,
  *****************************************************************************/
 void multifast_rep_flush (AC_TRIE_t *thiz, int keep)
 {
+    if (!thiz->root)
+        return;
+    
     if (!keep)
     {
         mf_repdata_do_replace (&thiz->repdata, thiz->base_position);
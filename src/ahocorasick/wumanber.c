@@ -0,0 +1,108 @@
+/*
+ * wumanber.c: Implements the Wu-Manber scanner
+ * This file is part of multifast.
+ *
+ * See the file "COPYING" in the main distribution directory for copyright.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "wumanber.h"
+
+/**
+ * @brief Builds a Wu-Manber scanner for a set of patterns
+ *
+ * @param patterns the patterns. The scanner keeps pointers to their text,
+ * which must stay valid for as long as the scanner is used.
+ * @param size the number of patterns
+ * @param min_length the scanner is only built if every pattern is at least
+ * this long; it must be at least ACWM_BLOCK
+ * @return The scanner, or NULL if a pattern is too short or memory could not
+ * be allocated
+ *****************************************************************************/
+AC_WM_t *ac_wm_create (const AC_PATTERN_t *patterns, size_t size,
+        size_t min_length)
+{
+    size_t i, q, window = ACWM_MAX_WINDOW;
+    uint32_t h, shift;
+    AC_WM_t *thiz;
+
+    if (size == 0 || min_length < ACWM_BLOCK)
+        return NULL;
+
+    for (i = 0; i < size; i++)
+    {
+        if (patterns[i].ptext.length < min_length)
+            return NULL;
+        if (patterns[i].ptext.length < window)
+            window = patterns[i].ptext.length;
+    }
+
+    if (!(thiz = (AC_WM_t *) calloc (1, sizeof(AC_WM_t))))
+        return NULL;
+
+    thiz->window = window;
+    thiz->patterns_size = size;
+    thiz->patterns = (AC_PATTERN_t *) malloc (size * sizeof(AC_PATTERN_t));
+    thiz->buckets = (uint32_t *) calloc
+            ((1 << ACWM_HASH_BITS) + 1, sizeof(uint32_t));
+    thiz->candidates = (uint32_t *) malloc (size * sizeof(uint32_t));
+
+    if (!thiz->patterns || !thiz->buckets || !thiz->candidates)
+    {
+        ac_wm_release (thiz);
+        return NULL;
+    }
+
+    memcpy (thiz->patterns, patterns, size * sizeof(AC_PATTERN_t));
+    memset (thiz->shift, (int) (window - ACWM_BLOCK + 1), sizeof(thiz->shift));
+
+    /* A block that ends q bytes into the window of a pattern allows the
+     * window to move until it ends there */
+    for (i = 0; i < size; i++)
+    {
+        for (q = ACWM_BLOCK; q <= window; q++)
+        {
+            h = ac_wm_hash (&patterns[i].ptext.astring[q - ACWM_BLOCK]);
+            shift = (uint32_t) (window - q);
+            if (shift < thiz->shift[h])
+                thiz->shift[h] = (uint8_t) shift;
+        }
+
+        thiz->buckets[ac_wm_hash
+                (&patterns[i].ptext.astring[window - ACWM_BLOCK]) + 1]++;
+    }
+
+    /* Group the patterns by the hash of the block that ends their window */
+    for (h = 0; h < (1 << ACWM_HASH_BITS); h++)
+        thiz->buckets[h + 1] += thiz->buckets[h];
+
+    for (i = 0; i < size; i++)
+    {
+        h = ac_wm_hash (&patterns[i].ptext.astring[window - ACWM_BLOCK]);
+        thiz->candidates[thiz->buckets[h]++] = (uint32_t) i;
+    }
+
+    for (h = (1 << ACWM_HASH_BITS); h > 0; h--)
+        thiz->buckets[h] = thiz->buckets[h - 1];
+    thiz->buckets[0] = 0;
+
+    return thiz;
+}
+
+/**
+ * @brief Release all allocated memories to the scanner
+ *
+ * @param thiz pointer to the scanner
+ *****************************************************************************/
+void ac_wm_release (AC_WM_t *thiz)
+{
+    if (!thiz)
+        return;
+
+    free (thiz->patterns);
+    free (thiz->buckets);
+    free (thiz->candidates);
+    free (thiz);
+}
@@ -0,0 +1,86 @@
+/*
+ * wumanber.h: Defines a Wu-Manber scanner over a set of long patterns
+ * This file is part of multifast.
+ *
+ * See the file "COPYING" in the main distribution directory for copyright.
+ *
+ * The Aho-Corasick automaton has to look at every byte of the text. When all
+ * patterns are long, most of the text can be skipped instead: the scanner
+ * slides a window as long as the shortest pattern over the text and looks at
+ * the block of ACWM_BLOCK bytes at its end. Unless that block also occurs
+ * within the first window bytes of some pattern, the window can be shifted
+ * past it. Where it ends such a prefix, the window is shifted so the block
+ * lines up with its last occurrence, and only windows in which it ends the
+ * prefix of a pattern are verified.
+ *
+ * The shift table is indexed by a hash of the block, so blocks that share a
+ * hash share the smallest of their shifts, which is always safe.
+*/
+
+#ifndef _AC_WUMANBER_H_
+#define _AC_WUMANBER_H_
+
+#include <stdint.h>
+#include "actypes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The number of bytes hashed to look up a shift
+ */
+#define ACWM_BLOCK 3
+
+/**
+ * The shift table has 2^ACWM_HASH_BITS entries
+ */
+#define ACWM_HASH_BITS 16
+
+/**
+ * Only this many leading bytes of each pattern are used to compute shifts,
+ * so that every shift fits a byte
+ */
+#define ACWM_MAX_WINDOW 255
+
+/**
+ * The Wu-Manber scanner
+ */
+typedef struct ac_wm
+{
+    uint8_t shift[1 << ACWM_HASH_BITS];  /**< How far the window may move
+                                          * given the hash of its last block */
+
+    uint32_t *buckets;      /**< Start of the candidates of every hash; has
+                             * 2^ACWM_HASH_BITS + 1 entries */
+    uint32_t *candidates;   /**< Pattern indices grouped by the hash of the
+                             * block that ends their window */
+
+    AC_PATTERN_t *patterns; /**< The patterns; their text is not copied */
+    size_t patterns_size;   /**< Number of patterns */
+
+    size_t window;          /**< The window length */
+
+} AC_WM_t;
+
+AC_WM_t *ac_wm_create (const AC_PATTERN_t *patterns, size_t size,
+        size_t min_length);
+void ac_wm_release (AC_WM_t *thiz);
+
+/**
+ * @brief Hashes the ACWM_BLOCK bytes at @p block
+ *****************************************************************************/
+static inline uint32_t ac_wm_hash (const AC_ALPHABET_t *block)
+{
+    uint32_t key = (uint32_t) (unsigned char) block[0] << 16
+            | (uint32_t) (unsigned char) block[1] << 8
+            | (uint32_t) (unsigned char) block[2];
+
+    return (key * 2654435761u) >> (32 - ACWM_HASH_BITS);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
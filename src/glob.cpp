@@ -0,0 +1,457 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include "paraglob/glob.h"
+
+#include <fnmatch.h>
+#include <bit>
+#include <cctype>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PARAGLOB_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PARAGLOB_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+using namespace paraglob;
+
+namespace {
+
+/* The searches below return the first position p in [from, last] where
+   data[p + a] == x and data[p + b] == y, or std::string::npos. Reading
+   data[last + max(a, b)] must be valid. */
+
+size_t find_pair_scalar(const char* data, size_t from, size_t last, size_t a, char x, size_t b, char y) {
+    while ( from <= last ) {
+        const void* hit = memchr(data + from + a, x, last - from + 1);
+        if ( ! hit )
+            return std::string::npos;
+
+        from = static_cast<const char*>(hit) - data - a;
+        if ( data[from + b] == y )
+            return from;
+
+        from++;
+    }
+
+    return std::string::npos;
+}
+
+size_t find_pair_sse2(const char* data, size_t from, size_t last, size_t a, char x, size_t b, char y) {
+#ifdef PARAGLOB_HAVE_SSE2
+    const __m128i first = _mm_set1_epi8(x);
+    const __m128i second = _mm_set1_epi8(y);
+
+    for ( ; from <= last && last - from >= 15; from += 16 ) {
+        __m128i at_a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from + a));
+        __m128i at_b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from + b));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(at_a, first), _mm_cmpeq_epi8(at_b, second)));
+        if ( mask )
+            return from + std::countr_zero(mask);
+    }
+#endif
+
+    return find_pair_scalar(data, from, last, a, x, b, y);
+}
+
+#ifdef PARAGLOB_HAVE_AVX2
+__attribute__((target("avx2")))
+#endif
+size_t find_pair_avx2(const char* data, size_t from, size_t last, size_t a, char x, size_t b, char y) {
+#ifdef PARAGLOB_HAVE_AVX2
+    const __m256i first = _mm256_set1_epi8(x);
+    const __m256i second = _mm256_set1_epi8(y);
+
+    for ( ; from <= last && last - from >= 31; from += 32 ) {
+        __m256i at_a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + from + a));
+        __m256i at_b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + from + b));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(at_a, first), _mm256_cmpeq_epi8(at_b, second)));
+        if ( mask )
+            return from + std::countr_zero(mask);
+    }
+#endif
+
+    return find_pair_sse2(data, from, last, a, x, b, y);
+}
+
+bool have_avx2() {
+#ifdef PARAGLOB_HAVE_AVX2
+    static const bool supported = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+struct CharClass {
+    const char* name;
+    int (*test)(int);
+};
+
+const CharClass char_classes[] = {
+    {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+    {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+    {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+};
+
+} // namespace
+
+Glob::Glob(std::string pattern) : source(std::move(pattern)) { this->compile(); }
+
+void Glob::compile() {
+    const std::string& p = this->source;
+    this->segments.push_back({0, 0});
+
+    size_t pos = 0;
+    while ( pos < p.size() ) {
+        Atom atom = {AtomKind::Byte, static_cast<uint8_t>(p[pos]), 0};
+
+        switch ( p[pos] ) {
+            case '*':
+                this->has_star = true;
+                this->segments.push_back({static_cast<uint32_t>(this->atoms.size()),
+                                          static_cast<uint32_t>(this->atoms.size())});
+                pos++;
+                continue;
+
+            case '?':
+                atom.kind = AtomKind::Any;
+                pos++;
+                break;
+
+            case '\\':
+                // A trailing backslash never matches anything.
+                if ( pos + 1 == p.size() ) {
+                    this->never_matches = true;
+                    return;
+                }
+                atom.byte = static_cast<uint8_t>(p[pos + 1]);
+                pos += 2;
+                break;
+
+            case '[': {
+                size_t end = pos;
+                BracketResult result = this->parse_bracket(end);
+
+                if ( result == BracketResult::Unsupported ) {
+                    this->use_fnmatch = true;
+                    return;
+                }
+
+                if ( result == BracketResult::Parsed ) {
+                    atom.kind = AtomKind::Set;
+                    atom.set = static_cast<uint16_t>(this->sets.size() - 1);
+                    pos = end;
+                }
+                else {
+                    // An unterminated bracket is an ordinary '['.
+                    pos++;
+                }
+                break;
+            }
+
+            default: pos++; break;
+        }
+
+        this->atoms.push_back(atom);
+        this->segments.back().end = static_cast<uint32_t>(this->atoms.size());
+    }
+
+    for ( Segment& segment : this->segments ) {
+        for ( uint32_t i = segment.begin; i < segment.end; i++ ) {
+            if ( this->atoms[i].kind != AtomKind::Byte )
+                continue;
+
+            if ( segment.first_literal == UINT32_MAX )
+                segment.first_literal = i - segment.begin;
+            segment.last_literal = i - segment.begin;
+        }
+    }
+}
+
+// Parses the bracket expression starting at pos the way glibc does and
+// appends its set. On success, pos is moved past the closing bracket.
+Glob::BracketResult Glob::parse_bracket(size_t& pos) {
+    const std::string& p = this->source;
+    ByteSet set = {0, 0, 0, 0};
+    auto add = [&set](unsigned char c) { set[c >> 6] |= uint64_t(1) << (c & 63); };
+
+    size_t j = pos + 1;
+    bool negate = false;
+    if ( j < p.size() && (p[j] == '!' || p[j] == '^') ) {
+        negate = true;
+        j++;
+    }
+
+    for ( bool first = true;; first = false ) {
+        if ( j >= p.size() )
+            return BracketResult::Unterminated;
+
+        unsigned char lo = p[j];
+
+        if ( lo == ']' && ! first ) {
+            j++;
+            break;
+        }
+
+        if ( lo == '\\' ) {
+            if ( j + 1 >= p.size() )
+                return BracketResult::Unsupported;
+            lo = p[j + 1];
+            j += 2;
+        }
+        else if ( lo == '[' && j + 1 < p.size() && (p[j + 1] == '=' || p[j + 1] == '.') ) {
+            return BracketResult::Unsupported;
+        }
+        else if ( lo == '[' && j + 1 < p.size() && p[j + 1] == ':' ) {
+            size_t close = p.find(":]", j + 2);
+            if ( close == std::string::npos )
+                return BracketResult::Unsupported;
+
+            std::string_view name(p.data() + j + 2, close - j - 2);
+            const CharClass* found = nullptr;
+            for ( const auto& c : char_classes )
+                if ( name == c.name )
+                    found = &c;
+
+            if ( ! found )
+                return BracketResult::Unsupported;
+
+            for ( int c = 0; c < 256; c++ )
+                if ( found->test(c) )
+                    add(c);
+
+            j = close + 2;
+            continue;
+        }
+        else {
+            j++;
+        }
+
+        // A range that runs past the end of the pattern leaves glibc without
+        // a match, even though the bracket is then unterminated.
+        if ( j + 1 == p.size() && p[j] == '-' )
+            return BracketResult::Unsupported;
+
+        // A range, unless the '-' is the last character of the bracket
+        if ( j + 1 < p.size() && p[j] == '-' && p[j + 1] != ']' ) {
+            unsigned char hi = p[j + 1];
+
+            if ( hi == '\\' ) {
+                if ( j + 2 >= p.size() )
+                    return BracketResult::Unsupported;
+                hi = p[j + 2];
+                j += 3;
+            }
+            else if ( hi == '[' && j + 2 < p.size() && (p[j + 2] == '=' || p[j + 2] == '.' || p[j + 2] == ':') ) {
+                return BracketResult::Unsupported;
+            }
+            else {
+                j += 2;
+            }
+
+            for ( unsigned c = lo; c <= hi; c++ )
+                add(c);
+        }
+        else {
+            add(lo);
+        }
+    }
+
+    if ( this->sets.size() > UINT16_MAX )
+        return BracketResult::Unsupported;
+
+    if ( negate )
+        for ( auto& word : set )
+            word = ~word;
+
+    this->sets.push_back(set);
+    pos = j;
+    return BracketResult::Parsed;
+}
+
+bool Glob::atom_matches(const Atom& atom, uint8_t c) const {
+    switch ( atom.kind ) {
+        case AtomKind::Byte: return atom.byte == c;
+        case AtomKind::Any: return true;
+        case AtomKind::Set: return (this->sets[atom.set][c >> 6] >> (c & 63)) & 1;
+    }
+    return false;
+}
+
+bool Glob::segment_matches_at(const Segment& segment, std::string_view subject, size_t pos) const {
+    for ( uint32_t i = segment.begin; i < segment.end; i++, pos++ )
+        if ( ! this->atom_matches(this->atoms[i], static_cast<uint8_t>(subject[pos])) )
+            return false;
+
+    return true;
+}
+
+// Returns the leftmost position in [from, to - size] where the segment
+// matches, or std::string::npos. Only positions where the first and the
+// last literal byte of the segment line up are tried, and those are found
+// 16 or 32 at a time where the CPU allows.
+size_t Glob::find_segment(const Segment& segment, std::string_view subject, size_t from, size_t to) const {
+    size_t size = segment.size();
+    if ( to - from < size )
+        return std::string::npos;
+
+    size_t last = to - size;
+    const char* data = subject.data();
+
+    if ( segment.first_literal == UINT32_MAX ) {
+        for ( ; from <= last; from++ )
+            if ( this->segment_matches_at(segment, subject, from) )
+                return from;
+
+        return std::string::npos;
+    }
+
+    size_t a = segment.first_literal;
+    size_t b = segment.last_literal;
+    char x = static_cast<char>(this->atoms[segment.begin + a].byte);
+    char y = static_cast<char>(this->atoms[segment.begin + b].byte);
+    auto find_pair = have_avx2() ? find_pair_avx2 : find_pair_sse2;
+
+    while ( from <= last ) {
+        from = find_pair(data, from, last, a, x, b, y);
+        if ( from == std::string::npos )
+            return std::string::npos;
+
+        if ( this->segment_matches_at(segment, subject, from) )
+            return from;
+
+        from++;
+    }
+
+    return std::string::npos;
+}
+
+bool Glob::matches(std::string_view subject) const {
+    if ( this->use_fnmatch )
+        return fnmatch(this->source.c_str(), std::string(subject).c_str(), 0) == 0;
+
+    if ( this->never_matches )
+        return false;
+
+    const Segment& head = this->segments.front();
+
+    if ( ! this->has_star )
+        return subject.size() == head.size() && this->segment_matches_at(head, subject, 0);
+
+    const Segment& tail = this->segments.back();
+
+    if ( head.size() + tail.size() > subject.size() )
+        return false;
+
+    size_t tail_pos = subject.size() - tail.size();
+    if ( ! this->segment_matches_at(head, subject, 0) || ! this->segment_matches_at(tail, subject, tail_pos) )
+        return false;
+
+    size_t pos = head.size();
+    for ( size_t i = 1; i + 1 < this->segments.size(); i++ ) {
+        const Segment& middle = this->segments[i];
+        if ( middle.size() == 0 )
+            continue;
+
+        size_t found = this->find_segment(middle, subject, pos, tail_pos);
+        if ( found == std::string::npos )
+            return false;
+
+        pos = found + middle.size();
+    }
+
+    return true;
+}
+
+std::vector<std::string> Glob::literals() const {
+    std::vector<std::string> result;
+    if ( this->use_fnmatch || this->never_matches )
+        return result;
+
+    for ( const Segment& segment : this->segments ) {
+        std::string run;
+        for ( uint32_t i = segment.begin; i <= segment.end; i++ ) {
+            if ( i < segment.end && this->atoms[i].kind == AtomKind::Byte ) {
+                run += static_cast<char>(this->atoms[i].byte);
+            }
+            else if ( ! run.empty() ) {
+                result.push_back(std::move(run));
+                run.clear();
+            }
+        }
+    }
+
+    return result;
+}
+
+// Every atom matches exactly one byte. Patterns left to fnmatch get bounds
+// that reject nothing.
+size_t Glob::min_length() const {
+    if ( this->use_fnmatch || this->never_matches )
+        return 0;
+
+    return this->atoms.size();
+}
+
+size_t Glob::max_length() const {
+    if ( this->use_fnmatch || this->never_matches || this->has_star )
+        return SIZE_MAX;
+
+    return this->atoms.size();
+}
+
+int Glob::first_byte() const {
+    if ( this->use_fnmatch || this->never_matches )
+        return -1;
+
+    const Segment& head = this->segments.front();
+    if ( head.size() == 0 || this->atoms[head.begin].kind != AtomKind::Byte )
+        return -1;
+
+    return this->atoms[head.begin].byte;
+}
+
+int Glob::last_byte() const {
+    if ( this->use_fnmatch || this->never_matches )
+        return -1;
+
+    const Segment& tail = this->segments.back();
+    if ( tail.size() == 0 || this->atoms[tail.end - 1].kind != AtomKind::Byte )
+        return -1;
+
+    return this->atoms[tail.end - 1].byte;
+}
+
+// Every segment but the first one starts right after a star.
+bool Glob::star_before(size_t position) const {
+    for ( size_t i = 1; i < this->segments.size(); i++ )
+        if ( this->segments[i].begin == position )
+            return true;
+
+    return false;
+}
+
+// Every atom is encoded as its kind followed by the byte or the bytes of
+// its set, which keeps the encoding unambiguous.
+std::string Glob::segment_key(size_t segment) const {
+    std::string key;
+    for ( uint32_t i = this->segments[segment].begin; i < this->segments[segment].end; i++ ) {
+        const Atom& atom = this->atoms[i];
+        key += static_cast<char>(atom.kind);
+
+        if ( atom.kind == AtomKind::Byte )
+            key += static_cast<char>(atom.byte);
+        else if ( atom.kind == AtomKind::Set )
+            key.append(reinterpret_cast<const char*>(this->sets[atom.set].data()), sizeof(ByteSet));
+    }
+
+    return key;
+}
@@ -2,6 +2,7 @@
 
 #include "paraglob/paraglob.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <sstream>
 
@@ -13,60 +14,635 @@ using namespace paraglob;
 
 Paraglob::Paraglob() : my_ac(new AhoCorasickPlus) {}
 
-Paraglob::Paraglob(const std::vector<std::string>& patterns) : my_ac(new AhoCorasickPlus) {
+Paraglob::Paraglob(const std::vector<std::string>& patterns, const CompileOptions& options)
+    : my_ac(new AhoCorasickPlus) {
     for ( const std::string& pattern : patterns ) {
         if ( ! (this->add(pattern)) ) {
             throw paraglob::add_error("Failed to add pattern: " + pattern);
         }
     }
-    this->compile();
+    this->compile(options);
 }
 
-Paraglob::Paraglob(std::unique_ptr<std::vector<uint8_t>> serialized)
-    : Paraglob(ParaglobSerializer::unserialize(serialized)) {}
+Paraglob::Paraglob(std::unique_ptr<std::vector<uint8_t>> serialized, const CompileOptions& options)
+    : my_ac(new AhoCorasickPlus) {
+    std::vector<uint64_t> payloads;
+    std::vector<std::string> patterns = ParaglobSerializer::unserialize(serialized, &payloads);
+
+    // Adding the patterns in the order they were numbered restores their ids.
+    for ( size_t i = 0; i < patterns.size(); i++ ) {
+        if ( ! this->add(patterns[i], payloads[i]) ) {
+            throw paraglob::add_error("Failed to add pattern: " + patterns[i]);
+        }
+    }
+    this->compile(options);
+}
 
 Paraglob::~Paraglob() = default;
 
-bool Paraglob::add(const std::string& pattern) {
-    AhoCorasickPlus::EnumReturnStatus status;
+bool Paraglob::add(const std::string& pattern) { return this->add(pattern, 0).has_value(); }
+
+std::optional<PatternId> Paraglob::add(const std::string& pattern, uint64_t payload) {
+    // A pattern that was added before changes nothing.
+    if ( auto it = this->pattern_ids.find(pattern); it != this->pattern_ids.end() )
+        return it->second;
+
+    // Once compiled, the automaton takes no more meta words, and the patterns
+    // are ranked.
+    if ( this->compiled )
+        return std::nullopt;
+
+    PatternId id = this->patterns.size();
+    this->patterns.push_back(pattern);
+    this->payloads.push_back(payload);
+    this->pattern_ids.emplace(pattern, id);
+
+    std::vector<std::string> words = this->get_meta_words(pattern);
+
+    if ( words.empty() ) {
+        // The empty pattern is kept for its id, but never matches.
+        if ( pattern.empty() )
+            return id;
+
+        // Patterns of only '*' and '?' depend on nothing but the length of
+        // the text. The others, ex: '[ab]', are matched against every text.
+        if ( pattern.find_first_not_of("*?") == std::string::npos ) {
+            size_t length = std::count(pattern.begin(), pattern.end(), '?');
+            if ( pattern.find('*') != std::string::npos )
+                this->open_wildcards.push_back({length, pattern});
+            else
+                this->fixed_wildcards.push_back({length, pattern});
+        }
+        else {
+            this->unindexed_globs.emplace_back(pattern);
+        }
+
+        return id;
+    }
+
+    auto glob = std::make_unique<Glob>(pattern);
 
-    for ( const std::string& meta_word : this->get_meta_words(pattern) ) {
-        AhoCorasickPlus::PatternId patId = this->meta_words.size();
-        status = this->my_ac->addPattern(meta_word, patId, true);
+    // Every text the glob matches contains the meta words that lie within
+    // one of its literal runs. The splitting in get_meta_words() does not
+    // know about escapes and brackets, so other meta words may not occur.
+    std::vector<std::string> literals = glob->literals();
+    auto is_required = [&literals](const std::string& word) {
+        return std::any_of(literals.begin(), literals.end(),
+                           [&word](const std::string& literal) { return literal.find(word) != std::string::npos; });
+    };
+
+    // A meta word that occurs more than once in the pattern counts once.
+    std::vector<std::string> distinct;
+    for ( const std::string& word : words )
+        if ( std::find(distinct.begin(), distinct.end(), word) == distinct.end() )
+            distinct.push_back(word);
+
+    // Without any required meta word, ex: '[]a]x', whose meta word 'a]x'
+    // is split across a bracket, no meta word tells which texts may match.
+    uint32_t required = std::count_if(distinct.begin(), distinct.end(), is_required);
+    if ( required == 0 ) {
+        this->unindexed_globs.emplace_back(pattern);
+        return id;
+    }
+
+    uint32_t index = this->globs.size();
+    this->glob_required.push_back(required);
+
+    // Without '?', brackets or escapes, the meta words are exactly the
+    // literals between the stars, and the pattern can be decided from where
+    // they were found.
+    LiteralLayout& layout = this->glob_layouts.emplace_back();
+    if ( pattern.find_first_of("?[\\") == std::string::npos ) {
+        layout.anchored_start = (pattern.front() != '*');
+        layout.anchored_end = (pattern.back() != '*');
+
+        if ( words.size() > 1 )
+            layout.shape = Shape::Literals;
+        else if ( layout.anchored_start && layout.anchored_end )
+            layout.shape = Shape::Exact;
+        else if ( layout.anchored_start )
+            layout.shape = Shape::Prefix;
+        else if ( layout.anchored_end )
+            layout.shape = Shape::Suffix;
+        else
+            layout.shape = Shape::Contains;
+    }
 
-        if ( status == AhoCorasickPlus::RETURNSTATUS_SUCCESS ) {
+    this->shortest_pattern = std::min(this->shortest_pattern, glob->min_length());
+
+    // The meta words go into the automaton once compile() knows which of
+    // them are needed.
+    std::unordered_map<std::string_view, uint32_t> word_ids;
+    std::vector<uint32_t>& keys = this->glob_keys.emplace_back();
+
+    for ( const std::string& meta_word : distinct ) {
+        uint32_t id;
+
+        if ( auto it = this->meta_to_node_map.find(meta_word); it != this->meta_to_node_map.end() ) {
+            id = it->second.get_id();
+        }
+        else {
+            id = this->meta_words.size();
             this->meta_words.push_back(meta_word);
             // Build the new paraglobNode in place.
-            this->meta_to_node_map.emplace(std::piecewise_construct, std::forward_as_tuple(meta_word),
-                                           std::forward_as_tuple(meta_word, pattern));
+            auto [node, inserted] = this->meta_to_node_map.emplace(meta_word, ParaglobNode(id, meta_word));
+            this->meta_nodes.push_back(&node->second);
+        }
+
+        if ( is_required(meta_word) )
+            keys.push_back(id);
+
+        word_ids.emplace(meta_word, id);
+    }
+
+    if ( layout.shape != Shape::General )
+        for ( const std::string& word : words )
+            layout.words.push_back(word_ids.at(word));
+
+    if ( layout.shape == Shape::Exact )
+        this->exact_patterns.emplace(glob->pattern(), index);
+    else if ( layout.anchored_start )
+        this->prefixes.insert(this->meta_words[layout.words.front()], index);
+    else if ( layout.anchored_end )
+        this->suffixes.insert(this->meta_words[layout.words.back()], index);
+
+    this->globs.push_back(std::move(glob));
+    return id;
+}
+
+void Paraglob::compile(const CompileOptions& options) {
+    // The patterns are indexed once, and none can be added afterwards.
+    if ( this->compiled )
+        return;
+
+    this->compiled = true;
+    this->index_patterns(options);
+
+    AhoCorasickPlus::FinalizeOptions ac_options;
+    ac_options.fullDfa = options.full_dfa;
+    ac_options.dfaMaxSize = options.dfa_max_size;
+    ac_options.skipScanMinLength = options.skip_scan_min_length;
+    this->my_ac->finalize(ac_options);
+
+    // Results are put in order by the rank of each pattern among all of
+    // them, which is cheaper than sorting the strings.
+    this->ranked_ids.clear();
+    for ( PatternId id = 0; id < this->patterns.size(); id++ )
+        if ( ! this->patterns[id].empty() )
+            this->ranked_ids.push_back(id);
+
+    std::sort(this->ranked_ids.begin(), this->ranked_ids.end(),
+              [this](PatternId a, PatternId b) { return this->patterns[a] < this->patterns[b]; });
+
+    std::vector<uint32_t> ranks(this->patterns.size());
+    for ( uint32_t rank = 0; rank < this->ranked_ids.size(); rank++ )
+        ranks[this->ranked_ids[rank]] = rank;
+
+    auto rank_of = [this, &ranks](const std::string& pattern) { return ranks[this->pattern_ids.at(pattern)]; };
+
+    this->glob_ranks.clear();
+    for ( const auto& glob : this->globs )
+        this->glob_ranks.push_back(rank_of(glob->pattern()));
+
+    this->unindexed_ranks.clear();
+    for ( const Glob& glob : this->unindexed_globs )
+        this->unindexed_ranks.push_back(rank_of(glob.pattern()));
+
+    for ( auto* wildcards : {&this->open_wildcards, &this->fixed_wildcards} ) {
+        std::sort(wildcards->begin(), wildcards->end());
+        for ( Wildcard& wildcard : *wildcards )
+            wildcard.rank = rank_of(wildcard.pattern);
+    }
+}
+
+// Lists every glob under the meta words that trigger its verification, and
+// adds the meta words that are needed to the automaton.
+void Paraglob::index_patterns(const CompileOptions& options) {
+    bool selective = (options.index_policy == CompileOptions::IndexPolicy::MostSelective);
+
+    // How often each meta word occurs in the sample texts
+    std::vector<uint64_t> frequency(this->meta_words.size());
+    if ( selective && ! options.sample_texts.empty() ) {
+        AhoCorasickPlus sampler;
+        for ( uint32_t id = 0; id < this->meta_words.size(); id++ )
+            sampler.addPattern(this->meta_words[id], id);
+
+        sampler.finalize();
+        for ( const std::string& text : options.sample_texts )
+            sampler.visit(text, [&frequency](const AhoCorasickPlus::Match& match) {
+                frequency[match.id]++;
+                return true;
+            });
+    }
+
+    // The rarest meta word, or the longest one if they are equally rare
+    auto more_selective = [&](uint32_t a, uint32_t b) {
+        if ( frequency[a] != frequency[b] )
+            return frequency[a] < frequency[b];
+        return this->meta_words[a].size() > this->meta_words[b].size();
+    };
+
+    std::vector<bool> scanned(this->meta_words.size());
+
+    for ( uint32_t index = 0; index < this->globs.size(); index++ ) {
+        LiteralLayout& layout = this->glob_layouts[index];
+        std::vector<uint32_t> keys = this->glob_keys[index];
+
+        // Every meta word the glob requires has to be found in a matching
+        // text anyway. Indexing it under just one of them leaves the rest
+        // to the matcher, which then also has to order the literals.
+        if ( selective && keys.size() == this->glob_required[index] ) {
+            keys = {*std::min_element(keys.begin(), keys.end(), more_selective)};
+            this->glob_required[index] = 1;
+            if ( layout.shape == Shape::Literals )
+                layout.shape = Shape::General;
         }
-        else if ( status == AhoCorasickPlus::RETURNSTATUS_DUPLICATE_PATTERN ) {
-            this->meta_to_node_map.at(meta_word).add_pattern(pattern);
+
+        if ( layout.shape == Shape::Literals )
+            for ( uint32_t id : layout.words )
+                scanned[id] = true;
+
+        if ( layout.shape == Shape::Contains ) {
+            this->meta_nodes[keys.front()]->add_containing(index);
+            scanned[keys.front()] = true;
+            continue;
         }
-        else { // Failed to add
-            return false;
+
+        // Anchored patterns are found through the whole text or the anchor
+        // tries instead.
+        if ( layout.anchored_start || layout.anchored_end )
+            continue;
+
+        // What a text has to look like for the glob to be worth verifying
+        const Glob& glob = *this->globs[index];
+        Candidate candidate = {index,
+                               static_cast<uint32_t>(std::min<size_t>(glob.min_length(), UINT32_MAX)),
+                               static_cast<uint32_t>(std::min<size_t>(glob.max_length(), UINT32_MAX)),
+                               static_cast<int16_t>(glob.first_byte()), static_cast<int16_t>(glob.last_byte())};
+
+        for ( uint32_t id : keys ) {
+            this->meta_nodes[id]->add_pattern(candidate);
+            scanned[id] = true;
         }
     }
 
-    return true;
+    // Verify the patterns of crowded meta words together
+    for ( ParaglobNode* node : this->meta_nodes ) {
+        if ( options.segment_trie_min_patterns && node->get_patterns().size() >= options.segment_trie_min_patterns )
+            node->share_patterns(this->globs, this->glob_required);
+
+        if ( options.bit_parallel_min_patterns && node->get_patterns().size() >= options.bit_parallel_min_patterns )
+            node->pack_patterns(this->globs, this->glob_required);
+    }
+
+    for ( uint32_t id = 0; id < this->meta_words.size(); id++ )
+        if ( scanned[id] )
+            this->my_ac->addPattern(this->meta_words[id], id, true);
 }
 
-void Paraglob::compile() { this->my_ac->finalize(); }
+void QueryContext::begin(size_t nodes, size_t patterns) {
+    if ( ++this->epoch == 0 ) {
+        for ( auto* stamps : {&this->node_seen, &this->node_contained, &this->pattern_seen, &this->pattern_found} )
+            std::fill(stamps->begin(), stamps->end(), 0);
+        this->epoch = 1;
+    }
 
-std::vector<std::string> Paraglob::get(const std::string& text) {
-    // Narrow to the meta-word matches
-    std::vector<std::string> patterns;
-    for ( int id : this->my_ac->findAll(text, false) )
-        this->meta_to_node_map.at(this->meta_words.at(id)).merge_matches(patterns, text);
+    if ( this->node_seen.size() < nodes ) {
+        this->node_seen.resize(nodes);
+        this->node_contained.resize(nodes);
+    }
 
-    // Single wildcards always need to be checked
-    if ( this->single_wildcards.size() > 0 )
-        patterns.insert(patterns.end(), this->single_wildcards.begin(), this->single_wildcards.end());
+    if ( this->pattern_seen.size() < patterns ) {
+        this->pattern_seen.resize(patterns);
+        this->pattern_count.resize(patterns);
+        this->pattern_found.resize(patterns);
+    }
 
-    // Remove duplicates
-    std::sort(patterns.begin(), patterns.end());
-    patterns.erase(unique(patterns.begin(), patterns.end()), patterns.end());
-    return patterns;
+    this->matches.clear();
+    this->ready.clear();
+    this->matched.clear();
+}
+
+namespace {
+
+// The context of the queries that are not given one
+thread_local QueryContext thread_context;
+
+} // namespace
+
+struct Paraglob::Query {
+    Query(const Paraglob& paraglob, std::string_view subject, QueryContext& context, size_t limit)
+        : subject(subject),
+          limit(limit),
+          context(context),
+          matched(context.matched),
+          matches(context.matches),
+          ready(context.ready) {
+        this->context.begin(paraglob.meta_nodes.size(), paraglob.globs.size());
+        this->epoch = this->context.epoch;
+    }
+
+    bool done() const { return this->matched.size() >= this->limit; }
+
+    std::string_view subject; // The text up to its first NUL
+    size_t limit;             // How many patterns are enough
+
+    QueryContext& context;
+    uint32_t epoch;
+
+    std::vector<uint32_t>& matched;  // The ranks of the patterns found so far
+    std::vector<MetaMatch>& matches; // The meta words found so far
+    std::vector<uint32_t>& ready;    // Literal patterns left for finish_query
+};
+
+std::vector<std::string> Paraglob::get(const std::string& text) const {
+    std::vector<uint32_t>& matched = thread_context.matched;
+    this->find_ranks(text, thread_context, SIZE_MAX);
+    std::sort(matched.begin(), matched.end());
+
+    std::vector<std::string> results;
+    results.reserve(matched.size());
+    for ( uint32_t rank : matched )
+        results.push_back(this->patterns[this->ranked_ids[rank]]);
+
+    return results;
+}
+
+std::vector<PatternMatch> Paraglob::get_matches(const std::string& text, size_t limit) const {
+    std::span<const PatternMatch> results = this->get_matches(text, thread_context, limit);
+    return {results.begin(), results.end()};
+}
+
+bool Paraglob::any(const std::string& text) const { return this->any(text, thread_context); }
+
+size_t Paraglob::count(const std::string& text) const { return this->count(text, thread_context); }
+
+std::optional<PatternMatch> Paraglob::first(const std::string& text) const {
+    return this->first(text, thread_context);
+}
+
+std::span<const PatternMatch> Paraglob::get_matches(const std::string& text, QueryContext& context,
+                                                    size_t limit) const {
+    std::vector<uint32_t>& matched = context.matched;
+    context.results.clear();
+    if ( limit == 0 )
+        return {};
+
+    // The last check may have found more patterns than asked for.
+    this->find_ranks(text, context, limit);
+    if ( matched.size() > limit )
+        matched.resize(limit);
+
+    std::sort(matched.begin(), matched.end());
+
+    for ( uint32_t rank : matched ) {
+        PatternId id = this->ranked_ids[rank];
+        context.results.push_back({id, this->payloads[id]});
+    }
+
+    return context.results;
+}
+
+bool Paraglob::any(const std::string& text, QueryContext& context) const {
+    this->find_ranks(text, context, 1);
+    return ! context.matched.empty();
+}
+
+size_t Paraglob::count(const std::string& text, QueryContext& context) const {
+    this->find_ranks(text, context, SIZE_MAX);
+    return context.matched.size();
+}
+
+std::optional<PatternMatch> Paraglob::first(const std::string& text, QueryContext& context) const {
+    this->find_ranks(text, context, 1);
+    if ( context.matched.empty() )
+        return std::nullopt;
+
+    PatternId id = this->ranked_ids[context.matched.front()];
+    return PatternMatch{id, this->payloads[id]};
+}
+
+std::vector<std::vector<std::string>> Paraglob::get_batch(std::span<const std::string> texts) const {
+    if ( ! this->compiled )
+        return std::vector<std::vector<std::string>>(texts.size());
+
+    std::vector<std::string_view> views(texts.begin(), texts.end());
+    std::vector<std::vector<AhoCorasickPlus::Match>> found = this->my_ac->findAllBatch(views);
+
+    std::vector<std::vector<std::string>> results;
+    results.reserve(texts.size());
+    for ( size_t i = 0; i < texts.size(); i++ ) {
+        Query query(*this, texts[i].c_str(), thread_context, SIZE_MAX);
+
+        this->match_unscanned(query);
+        for ( const AhoCorasickPlus::Match& match : found[i] )
+            this->expand(query, {match.id, match.position});
+        this->finish_query(query);
+
+        std::sort(query.matched.begin(), query.matched.end());
+        std::vector<std::string>& patterns = results.emplace_back();
+        patterns.reserve(query.matched.size());
+        for ( uint32_t rank : query.matched )
+            patterns.push_back(this->patterns[this->ranked_ids[rank]]);
+    }
+
+    return results;
+}
+
+void Paraglob::find_ranks(const std::string& text, QueryContext& context, size_t limit) const {
+    // Like fnmatch, verification only looks at the text up to its first NUL
+    Query query(*this, text.c_str(), context, limit);
+
+    // Until compiled, the patterns are not ranked and match nothing.
+    if ( ! this->compiled )
+        return;
+
+    this->match_unscanned(query);
+
+    // Too short for any pattern with meta words
+    if ( query.done() || text.size() < this->shortest_pattern )
+        return;
+
+    // Patterns are verified as their meta words are found, so once enough
+    // of them matched, the rest of the text need not be scanned.
+    this->my_ac->visit(text, [this, &query](const AhoCorasickPlus::Match& match) {
+        this->expand(query, {match.id, match.position});
+        return ! query.done();
+    });
+
+    this->finish_query(query);
+}
+
+void Paraglob::match_unscanned(Query& query) const {
+    size_t length = query.subject.size();
+
+    // With a '*', a wildcard pattern matches any text at least as long as
+    // its '?'s. Without one, it matches texts of exactly that length.
+    auto longer = std::upper_bound(this->open_wildcards.begin(), this->open_wildcards.end(), length,
+                                   [](size_t length, const Wildcard& wildcard) { return length < wildcard.length; });
+    for ( auto it = this->open_wildcards.begin(); it != longer; ++it )
+        query.matched.push_back(it->rank);
+
+    auto fixed = std::lower_bound(this->fixed_wildcards.begin(), this->fixed_wildcards.end(), length,
+                                  [](const Wildcard& wildcard, size_t length) { return wildcard.length < length; });
+    if ( fixed != this->fixed_wildcards.end() && fixed->length == length )
+        query.matched.push_back(fixed->rank);
+
+    for ( size_t i = 0; i < this->unindexed_globs.size() && ! query.done(); i++ )
+        if ( this->unindexed_globs[i].matches(query.subject) )
+            query.matched.push_back(this->unindexed_ranks[i]);
+
+    if ( query.done() || length < this->shortest_pattern )
+        return;
+
+    if ( auto exact = this->exact_patterns.find(query.subject); exact != this->exact_patterns.end() )
+        query.matched.push_back(this->glob_ranks[exact->second]);
+}
+
+void Paraglob::expand(Query& query, const MetaMatch& match) const {
+    QueryContext& context = query.context;
+    uint32_t epoch = query.epoch;
+    const ParaglobNode* node = this->meta_nodes[match.id];
+    query.matches.push_back(match);
+
+    // An occurrence past the first NUL does not count for '*word*'
+    if ( match.end <= query.subject.size() && context.node_contained[match.id] != epoch ) {
+        context.node_contained[match.id] = epoch;
+        for ( uint32_t containing : node->get_containing() )
+            query.matched.push_back(this->glob_ranks[containing]);
+    }
+
+    // Each node is expanded the first time its meta word is found, so the
+    // count of a pattern is the number of its distinct meta words found. It
+    // becomes ready for verification exactly once, when that count reaches
+    // the number it requires.
+    if ( context.node_seen[match.id] == epoch || query.done() )
+        return;
+
+    context.node_seen[match.id] = epoch;
+
+    // A pattern can be verified together with others under one of its
+    // meta words and listed under another, so it is only reported once.
+    auto found = [&](uint32_t pattern) {
+        if ( context.pattern_found[pattern] != epoch ) {
+            context.pattern_found[pattern] = epoch;
+            query.matched.push_back(this->glob_ranks[pattern]);
+        }
+    };
+
+    if ( ! node->get_segments().empty() )
+        node->get_segments().match(query.subject, found);
+
+    if ( ! node->get_packed().empty() )
+        node->get_packed().match(query.subject, query.context.states, found);
+
+    // A pattern rejected here is short of one meta word, which rules it
+    // out just the same.
+    for ( const Candidate& listed : node->get_patterns() ) {
+        if ( ! listed.admits(query.subject) )
+            continue;
+
+        uint32_t pattern = listed.pattern;
+        if ( context.pattern_seen[pattern] != epoch ) {
+            context.pattern_seen[pattern] = epoch;
+            context.pattern_count[pattern] = 0;
+        }
+
+        if ( ++context.pattern_count[pattern] != this->glob_required[pattern] )
+            continue;
+
+        // Literal patterns are decided from the positions of all matches,
+        // which are only known once the scan is done.
+        if ( this->glob_layouts[pattern].shape == Shape::Literals )
+            query.ready.push_back(pattern);
+        else if ( context.pattern_found[pattern] != epoch && this->globs[pattern]->matches(query.subject) ) {
+            found(pattern);
+            if ( query.done() )
+                return;
+        }
+    }
+}
+
+void Paraglob::finish_query(Query& query) const {
+    if ( query.done() )
+        return;
+
+    // Only literal patterns need the positions of the matches, grouped by
+    // meta word and ordered by end.
+    bool grouped = false;
+    auto literals_match = [&](const LiteralLayout& layout) {
+        if ( ! grouped ) {
+            std::sort(query.matches.begin(), query.matches.end(), [](const MetaMatch& a, const MetaMatch& b) {
+                return a.id != b.id ? a.id < b.id : a.end < b.end;
+            });
+            grouped = true;
+        }
+
+        return this->matches_in_order(layout, query.matches, query.subject.size());
+    };
+
+    auto glob_matches = [&](uint32_t index) {
+        const LiteralLayout& layout = this->glob_layouts[index];
+        if ( layout.shape == Shape::Literals )
+            return literals_match(layout);
+        return this->globs[index]->matches(query.subject);
+    };
+
+    // The anchor tries only yield patterns whose anchored literal lines up
+    // with the start or end of the text.
+    auto anchored = [&](uint32_t index) {
+        Shape shape = this->glob_layouts[index].shape;
+        if ( ! query.done() && (shape == Shape::Prefix || shape == Shape::Suffix || glob_matches(index)) )
+            query.matched.push_back(this->glob_ranks[index]);
+    };
+
+    this->prefixes.find(query.subject, anchored);
+    this->suffixes.find(query.subject, anchored);
+
+    for ( uint32_t candidate : query.ready ) {
+        if ( query.done() )
+            return;
+
+        if ( query.context.pattern_found[candidate] != query.epoch && glob_matches(candidate) )
+            query.matched.push_back(this->glob_ranks[candidate]);
+    }
+}
+
+// The literals have to occur in order without overlapping. Placing each one
+// at its earliest end after the previous one never rules out a match, since
+// the star in between can absorb whatever is skipped.
+bool Paraglob::matches_in_order(const LiteralLayout& layout, const std::vector<MetaMatch>& matches,
+                                size_t length) const {
+    auto by_id = [](const MetaMatch& match, uint32_t id) { return match.id < id; };
+    auto before_id = [](uint32_t id, const MetaMatch& match) { return id < match.id; };
+    auto by_end = [](const MetaMatch& match, size_t end) { return match.end < end; };
+
+    size_t pos = 0;
+    for ( size_t i = 0; i < layout.words.size(); i++ ) {
+        uint32_t id = layout.words[i];
+        size_t earliest = pos + this->meta_words[id].size();
+
+        auto first = std::lower_bound(matches.begin(), matches.end(), id, by_id);
+        auto last = std::upper_bound(first, matches.end(), id, before_id);
+
+        // An anchored literal has exactly one place it can end
+        size_t wanted = 0;
+        if ( i == 0 && layout.anchored_start )
+            wanted = this->meta_words[id].size();
+        if ( i + 1 == layout.words.size() && layout.anchored_end ) {
+            if ( wanted && wanted != length )
+                return false;
+            wanted = length;
+        }
+
+        auto found = std::lower_bound(first, last, wanted ? wanted : earliest, by_end);
+        if ( found == last || found->end > length || found->end < earliest || (wanted && found->end != wanted) )
+            return false;
+
+        pos = found->end;
+    }
+
+    return true;
 }
 
 std::vector<std::string> Paraglob::split_on_brackets(const std::string& in) const {
@@ -92,7 +668,7 @@ std::vector<std::string> Paraglob::split_on_brackets(const std::string& in) cons
 }
 
 
-std::vector<std::string> Paraglob::get_meta_words(const std::string& pattern) {
+std::vector<std::string> Paraglob::get_meta_words(const std::string& pattern) const {
     std::vector<std::string> meta_words;
 
     // Split the pattern by brackets
@@ -111,25 +687,17 @@ std::vector<std::string> Paraglob::get_meta_words(const std::string& pattern) {
         }
     }
 
-    if ( meta_words.size() == 0 && pattern != "" ) {
-        this->single_wildcards.push_back(pattern);
-    }
     return meta_words;
 }
 
 std::vector<std::string> Paraglob::get_patterns() const {
     std::vector<std::string> patterns;
-    // Merge in all of the nodes patterns
-    for ( const auto& it : this->meta_to_node_map ) {
-        it.second.merge_patterns(patterns);
-    }
-    if ( this->single_wildcards.size() > 0 )
-        patterns.insert(patterns.end(), this->single_wildcards.begin(), this->single_wildcards.end());
+    for ( const std::string& pattern : this->patterns )
+        if ( ! pattern.empty() )
+            patterns.push_back(pattern);
 
-    // Remove the duplicate patterns. Duplicates don't effect the state.
+    // Every pattern is listed once, no matter how often it was added.
     std::sort(patterns.begin(), patterns.end());
-    patterns.erase(unique(patterns.begin(), patterns.end()), patterns.end());
-
     return patterns;
 }
 
@@ -144,8 +712,10 @@ std::vector<std::string> Paraglob::get_patterns() const {
 // itself in memory contiguously. Without a pressing use case for this
 // functionality, right now we're choosing not to do this. Instead, paraglob
 // serializes its vector of patterns, and rebuilds itself when unserialized.
+// The patterns are stored by id, with their payloads, so that they get the
+// same ids back.
 std::unique_ptr<std::vector<uint8_t>> Paraglob::serialize() const {
-    return ParaglobSerializer::serialize(this->get_patterns());
+    return ParaglobSerializer::serialize(this->patterns, this->payloads);
 }
 
 std::string Paraglob::str() const {
@@ -1,56 +1,92 @@
 // See the file "COPYING" in the main distribution directory for copyright.
 
+#include <algorithm>
+#include <cstring>
+
 #include "paraglob/exceptions.h"
 #include "paraglob/serializer.h"
 
 using namespace paraglob;
 
-std::unique_ptr<std::vector<uint8_t>> ParaglobSerializer::serialize(const std::vector<std::string>& v) {
+// The data starts with this in place of the number of strings, which can
+// never be that large, and then gives its version.
+static constexpr uint64_t serial_magic = 0x50474c4f42000000;
+static constexpr uint64_t serial_version = 2;
+
+std::unique_ptr<std::vector<uint8_t>> ParaglobSerializer::serialize(const std::vector<std::string>& v,
+                                                                    const std::vector<uint64_t>& payloads) {
     std::unique_ptr<std::vector<uint8_t>> ret(new std::vector<uint8_t>);
+
+    size_t size = 3 * sizeof(uint64_t);
+    for ( const std::string& s : v )
+        size += s.length() + 2 * sizeof(uint64_t);
+    ret->reserve(size);
+
+    add_int(serial_magic, *ret);
+    add_int(serial_version, *ret);
     add_int(v.size(), *ret);
 
-    for ( const std::string& s : v ) {
+    for ( size_t i = 0; i < v.size(); i++ ) {
+        const std::string& s = v[i];
         add_int(s.length(), *ret);
         for ( uint8_t c : s ) { // copy here because of type change
             ret->push_back(c);
         }
+        add_int(i < payloads.size() ? payloads[i] : 0, *ret);
     }
 
     return ret;
 }
 
-// ret -> [<n_strings><len_1><str_1>, <len_2><str_2>, ... <len_n><str_n>]
-std::vector<std::string> ParaglobSerializer::unserialize(const std::unique_ptr<std::vector<uint8_t>>& vsp) {
+// ret -> [<magic><version><n_strings><len_1><str_1><payload_1>, ... <len_n><str_n><payload_n>]
+//     or [<n_strings><len_1><str_1>, <len_2><str_2>, ... <len_n><str_n>] (version 1)
+std::vector<std::string> ParaglobSerializer::unserialize(const std::unique_ptr<std::vector<uint8_t>>& vsp,
+                                                         std::vector<uint64_t>* payloads) {
     std::vector<std::string> ret;
+    std::vector<uint64_t> read_payloads;
 
     std::vector<uint8_t>::iterator vsp_it = vsp->begin();
-    uint64_t n_strings = get_int_and_move(vsp_it);
+    std::vector<uint8_t>::iterator vsp_end = vsp->end();
+    uint64_t n_strings = get_int_and_move(vsp_it, vsp_end);
+    uint64_t version = 1;
 
-    // If n_strings is zero vsp_it will equal vsp->end
-    if ( vsp_it > vsp->end() ) {
-        throw paraglob::underflow_error("Serialization data ended unexpectedly.");
+    if ( n_strings == serial_magic ) {
+        version = get_int_and_move(vsp_it, vsp_end);
+        if ( version != serial_version )
+            throw paraglob::format_error("Unknown serialization version " + std::to_string(version) + ".");
+
+        n_strings = get_int_and_move(vsp_it, vsp_end);
     }
-    // Reserve space ahead of time rather than resizing in loop.
-    ret.reserve(n_strings);
 
-    while ( vsp_it < vsp->end() ) {
-        uint64_t l = get_int_and_move(vsp_it);
+    // Reserve space ahead of time rather than resizing in loop, but no more
+    // than the data can hold.
+    size_t room = (vsp_end - vsp_it) / sizeof(uint64_t);
+    ret.reserve(std::min<uint64_t>(n_strings, room));
+    read_payloads.reserve(std::min<uint64_t>(n_strings, room));
+
+    while ( vsp_it < vsp_end ) {
+        uint64_t l = get_int_and_move(vsp_it, vsp_end);
+        if ( l > static_cast<uint64_t>(vsp_end - vsp_it) ) {
+            throw paraglob::underflow_error("Serialization data ended unexpectedly.");
+        }
+
         ret.emplace_back(vsp_it, vsp_it + l);
         std::advance(vsp_it, l);
-    }
 
-    // If the read was successful, we have advanced our iterator exactly to the
-    // end, and we have read exactly n_strings.
-    if ( vsp_it > vsp->end() ) {
-        throw paraglob::underflow_error("Serialization data ended unexpectedly.");
+        read_payloads.push_back(version >= 2 ? get_int_and_move(vsp_it, vsp_end) : 0);
     }
-    else if ( ret.size() > n_strings ) {
+
+    // If the read was successful, we have read exactly n_strings.
+    if ( ret.size() > n_strings ) {
         throw paraglob::overflow_error("Read more patterns than expected.");
     }
     else if ( ret.size() < n_strings ) {
         throw paraglob::underflow_error("Read fewer patterns than expected.");
     }
 
+    if ( payloads )
+        *payloads = std::move(read_payloads);
+
     return ret;
 }
 
@@ -59,8 +95,15 @@ inline void ParaglobSerializer::add_int(uint64_t a, std::vector<uint8_t>& target
     target.insert(target.end(), chars, chars + sizeof(uint64_t));
 }
 
-inline uint64_t ParaglobSerializer::get_int_and_move(std::vector<uint8_t>::iterator& start) {
-    uint64_t ret = static_cast<uint64_t>(*start);
+inline uint64_t ParaglobSerializer::get_int_and_move(std::vector<uint8_t>::iterator& start,
+                                                     std::vector<uint8_t>::iterator end) {
+    if ( end - start < static_cast<std::ptrdiff_t>(sizeof(uint64_t)) ) {
+        throw paraglob::underflow_error("Serialization data ended unexpectedly.");
+    }
+
+    // All eight bytes, as add_int wrote them
+    uint64_t ret;
+    std::memcpy(&ret, &*start, sizeof(uint64_t));
     std::advance(start, sizeof(uint64_t));
     return ret;
 }
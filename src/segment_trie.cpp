@@ -0,0 +1,39 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include "paraglob/segment_trie.h"
+
+using namespace paraglob;
+
+bool SegmentTrie::add(const Glob& glob, uint32_t id) {
+    size_t count = glob.segment_count();
+    if ( ! glob.is_native() || count < 2 )
+        return false;
+
+    uint32_t index = 0;
+    for ( size_t segment = 0; segment + 1 < count; segment++ ) {
+        // Empty segments between two stars place nothing
+        if ( segment > 0 && glob.segment_size(segment) == 0 )
+            continue;
+
+        this->segments++;
+        std::string key = glob.segment_key(segment);
+        uint32_t child = 0;
+
+        for ( uint32_t candidate : this->nodes[index].children )
+            if ( this->nodes[candidate].key == key )
+                child = candidate;
+
+        if ( ! child ) {
+            child = this->nodes.size();
+            this->nodes[index].children.push_back(child);
+            this->nodes.push_back({std::move(key), &glob, static_cast<uint32_t>(segment), {}, {}});
+        }
+
+        index = child;
+    }
+
+    this->nodes[index].tails.push_back(this->tails.size());
+    this->tails.push_back({&glob, id});
+    this->globs++;
+    return true;
+}
@@ -0,0 +1,49 @@
+// See the file "COPYING" in the main distribution directory for copyright.
+
+#include "paraglob/shift_and.h"
+
+using namespace paraglob;
+
+bool ShiftAnd::add(const Glob& glob, uint32_t id) {
+    size_t positions = glob.positions();
+    if ( ! glob.is_native() || positions + 1 > 64 )
+        return false;
+
+    // Start a new word if the glob's states do not fit into the last one
+    if ( this->words.empty() || this->words.back().used + positions + 1 > 64 ) {
+        size_t count = this->words.size();
+        std::vector<uint64_t> accepts(256 * (count + 1));
+
+        for ( size_t byte = 0; byte < 256; byte++ )
+            for ( size_t w = 0; w < count; w++ )
+                accepts[byte * (count + 1) + w] = this->accepts[byte * count + w];
+
+        this->accepts = std::move(accepts);
+        this->words.emplace_back();
+    }
+
+    size_t count = this->words.size();
+    size_t w = count - 1;
+    Word& word = this->words[w];
+    size_t first = word.used;
+
+    word.starts |= uint64_t(1) << first;
+
+    for ( size_t i = 0; i <= positions; i++ ) {
+        uint64_t bit = uint64_t(1) << (first + i);
+
+        if ( glob.star_before(i) )
+            word.loops |= bit;
+
+        // State i is reached by matching position i - 1
+        if ( i > 0 )
+            for ( size_t byte = 0; byte < 256; byte++ )
+                if ( glob.accepts(i - 1, static_cast<uint8_t>(byte)) )
+                    this->accepts[byte * count + w] |= bit;
+    }
+
+    word.finals |= uint64_t(1) << (first + positions);
+    word.ids[first + positions] = id;
+    word.used += positions + 1;
+    return true;
+}
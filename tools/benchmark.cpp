@@ -2,9 +2,12 @@
 
 #include "benchmark.h"
 
+#include <chrono>
 #include <iostream>
 #include <memory>
 #include <random>
+#include <string>
+#include <vector>
 
 #include "paraglob/paraglob.h"
 
@@ -140,6 +143,93 @@ double benchmark_n(long num_patterns, long num_queries, long match_prob, bool si
     return elapsed.count() + build_time.count();
 }
 
+// Size of the pattern set that benchmark_long() compares against as well
+static const long large_pattern_set = 100000;
+
+static std::string random_long_word() {
+    std::string word;
+    int length = (rand_int() % 13) + 8;
+    for ( int j = 0; j < length; j++ )
+        word += (char)((rand_int() % 26) + 'a');
+
+    return word;
+}
+
+static double time_queries(const paraglob::Paraglob& glob, const std::vector<std::string>& queries) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for ( const auto& q : queries )
+        glob.get(q);
+    auto finish = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = finish - start;
+    return elapsed.count();
+}
+
+// Times the same queries with and without the skip scanner and returns the
+// time taken with it.
+static double compare_scanners(long num_patterns, long num_queries, long text_length, bool silent) {
+    // Every meta word is at least 8 bytes long.
+    std::vector<std::string> patterns;
+    std::vector<std::string> words;
+    for ( long i = 0; i < num_patterns; i++ ) {
+        std::string pattern = "*";
+        int rounds = (rand_int() % 3) + 1;
+        for ( int j = 0; j < rounds; j++ ) {
+            words.push_back(random_long_word());
+            pattern += words.back() + "*";
+        }
+        patterns.push_back(pattern);
+    }
+
+    // Random text with a meta word mixed in now and then.
+    std::vector<std::string> queries;
+    for ( long i = 0; i < num_queries; i++ ) {
+        std::string query;
+        while ( (long)query.size() < text_length ) {
+            if ( (rand_int() % 1000) == 0 )
+                query += words[rand_int() % words.size()];
+            else
+                query += (char)((rand_int() % 26) + 'a');
+        }
+        queries.push_back(query);
+    }
+
+    paraglob::CompileOptions skip_scan;
+    skip_scan.skip_scan_min_length = 8;
+
+    paraglob::Paraglob skipping(patterns, skip_scan);
+    paraglob::Paraglob automaton(patterns);
+
+    double skip_time = time_queries(skipping, queries);
+    double automaton_time = time_queries(automaton, queries);
+
+    if ( ! silent ) {
+        double megabytes = (double)num_queries * text_length / 1e6;
+        std::cout << num_patterns << " patterns:\n";
+        std::cout << "\tSkip scan: " << skip_time << " s, " << megabytes / skip_time << " MB/s\n";
+        std::cout << "\tAutomaton: " << automaton_time << " s, " << megabytes / automaton_time << " MB/s\n";
+    }
+
+    return skip_time;
+}
+
+double benchmark_long(long num_patterns, long num_queries, long text_length, bool silent) {
+    if ( ! silent ) {
+        std::cout << "creating long text workload:\n";
+        std::cout << "\t# patterns: " << num_patterns << "\n";
+        std::cout << "\t# queries: " << num_queries << "\n";
+        std::cout << "\ttext length: " << text_length << "\n";
+    }
+
+    double skip_time = compare_scanners(num_patterns, num_queries, text_length, silent);
+
+    // The skip scanner only pays off while its shift table is sparse, so a
+    // large set shows where it falls behind the automaton.
+    if ( ! silent && num_patterns < large_pattern_set )
+        compare_scanners(large_pattern_set, num_queries, text_length, silent);
+
+    return skip_time;
+}
+
 void makeGraphData() {
     /*
     prints data to the console for generation of 3d plot
@@ -8,4 +8,10 @@
 double benchmark(char* a, char* b, char* c, bool silent);
 double benchmark_n(long num_patterns, long num_queries, long match_prob, bool silent);
 
+/* Times queries of long texts against patterns whose meta words are all at
+   least 8 bytes long, with and without the skip scanner. Unless silent, also
+   compares the two for a set of 100000 patterns, where the skip scanner
+   falls behind. */
+double benchmark_long(long num_patterns, long num_queries, long text_length, bool silent);
+
 void makeGraphData();
@@ -5,7 +5,28 @@ A simple driver for testing paraglob's performance and functionality.
 
 Supports the following arguments:
     -b <a> <b> <c> <time>	-> Benchmark paraglob.  See below.
+    -l <a> <b> <length>	-> Benchmark paraglob on long texts of <length> bytes,
+                           with and without the skip scanner, for <a> and for
+                           100000 patterns.
     -n <text> <patterns>	-> Print the number of matching patterns in the text.
+    -q <limit> <text> <patterns>	-> Print what each kind of query returns for the
+                           text, get_matches with the given limit.
+    -u <limit> <text> <patterns>	-> Like -q, but without compiling the paraglob.
+    -r <limit> <text> <patterns>	-> Like -q, but compiling the paraglob twice.
+    -x <options> <limit> <text> <patterns>	-> Like -q, but compiling the paraglob
+                           with the given options. See below.
+    -y <options> <limit> <text> <patterns>	-> Like -x, but for the paraglob loaded
+                           from the serialization with the options.
+    -k <limit> <text> <patterns>	-> Like -q, for the patterns, then for every
+                           other one of them, then for all again, with the
+                           queries sharing one context.
+    -p <text> <patterns>	-> Add the patterns with payloads and print the ids,
+                           payloads and patterns matching the text before and
+                           after serializing.
+    -o <text> <patterns>	-> Load the patterns from the unversioned format and
+                           print the matches as -p does.
+    -c <patterns>	-> Load truncated and corrupted serializations and print
+                           the errors.
 
 Benchmarking:
     a	-> number of patterns to generate
@@ -16,26 +37,160 @@ Benchmarking:
                         prints 1 or 0 corresponding to rather or not the benchmark was
                         completed in under <time> seconds
 
+Compile options:
+    A comma separated list of the fields of CompileOptions to set, e.g.
+    "full_dfa,dfa_max_size=64,index_policy=most_selective,sample=abc".
+    full_dfa takes no value. index_policy is all_words or most_selective.
+    Every sample=<text> adds a sample text.
+
 Note that this script is just for testing and as such if you give it bad
 arguments it will ungracefully break.
 */
 
+#include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include "benchmark.h"
 #include "paraglob/exceptions.h"
 #include "paraglob/paraglob.h"
 
+// Prints the results of every kind of query for the text. With a context,
+// the queries that take one work in it.
+static void print_queries(const paraglob::Paraglob& p, const std::string& text, size_t limit,
+                          paraglob::QueryContext* context = nullptr) {
+    std::cout << "get: [ ";
+    for ( const std::string& pattern : p.get(text) )
+        std::cout << pattern << " ";
+    std::cout << "]\n";
+
+    std::vector<std::vector<std::string>> batch = p.get_batch(std::vector<std::string>{text});
+    std::cout << "batch: [ ";
+    for ( const std::string& pattern : batch.front() )
+        std::cout << pattern << " ";
+    std::cout << "]\n";
+
+    std::cout << "limit " << limit << ": [ ";
+    if ( context ) {
+        for ( const paraglob::PatternMatch& match : p.get_matches(text, *context, limit) )
+            std::cout << p.pattern(match.id) << " ";
+    }
+    else {
+        for ( const paraglob::PatternMatch& match : p.get_matches(text, limit) )
+            std::cout << p.pattern(match.id) << " ";
+    }
+    std::cout << "]\n";
+
+    std::cout << "count: " << (context ? p.count(text, *context) : p.count(text)) << "\n";
+    bool any = context ? p.any(text, *context) : p.any(text);
+    std::cout << "any: " << (any ? "true" : "false") << "\n";
+
+    if ( std::optional<paraglob::PatternMatch> match = context ? p.first(text, *context) : p.first(text) )
+        std::cout << "first: " << p.pattern(match->id) << "\n";
+    else
+        std::cout << "first: none\n";
+}
+
+// Parses a list of compile options, keeping the sample texts they name in
+// samples.
+static paraglob::CompileOptions parse_options(const std::string& spec, std::vector<std::string>& samples) {
+    paraglob::CompileOptions options;
+    std::istringstream list(spec);
+    std::string option;
+
+    while ( std::getline(list, option, ',') ) {
+        size_t equals = option.find('=');
+        std::string name = option.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : option.substr(equals + 1);
+
+        if ( name == "full_dfa" )
+            options.full_dfa = true;
+        else if ( name == "dfa_max_size" )
+            options.dfa_max_size = atol(value.c_str());
+        else if ( name == "skip_scan_min_length" )
+            options.skip_scan_min_length = atol(value.c_str());
+        else if ( name == "segment_trie_min_patterns" )
+            options.segment_trie_min_patterns = atol(value.c_str());
+        else if ( name == "bit_parallel_min_patterns" )
+            options.bit_parallel_min_patterns = atol(value.c_str());
+        else if ( name == "index_policy" && value == "all_words" )
+            options.index_policy = paraglob::CompileOptions::IndexPolicy::AllWords;
+        else if ( name == "index_policy" && value == "most_selective" )
+            options.index_policy = paraglob::CompileOptions::IndexPolicy::MostSelective;
+        else if ( name == "sample" )
+            samples.push_back(value);
+        else {
+            std::cerr << "Unrecognized compile option " << option << "\n";
+            exit(1);
+        }
+    }
+
+    options.sample_texts = samples;
+    return options;
+}
+
+// Prints the id, the payload and the pattern of every match.
+static void print_matches(const paraglob::Paraglob& p, const std::string& text) {
+    for ( const paraglob::PatternMatch& match : p.get_matches(text) )
+        std::cout << match.id << " " << match.payload << " " << p.pattern(match.id) << "\n";
+}
+
+// Appends an integer in the byte order of the serialization.
+static void append_int(std::vector<uint8_t>& data, uint64_t value) {
+    uint8_t bytes[sizeof(value)];
+    memcpy(bytes, &value, sizeof(value));
+    data.insert(data.end(), bytes, bytes + sizeof(value));
+}
+
+// Prints which error loading the data throws.
+static void print_load_error(const std::string& name, const std::vector<uint8_t>& data) {
+    std::cout << name << ": ";
+    try {
+        paraglob::Paraglob p(std::make_unique<std::vector<uint8_t>>(data));
+        std::cout << "loaded\n";
+    } catch ( const paraglob::underflow_error& e ) {
+        std::cout << "underflow_error: " << e.what() << "\n";
+    } catch ( const paraglob::overflow_error& e ) {
+        std::cout << "overflow_error: " << e.what() << "\n";
+    } catch ( const paraglob::format_error& e ) {
+        std::cout << "format_error: " << e.what() << "\n";
+    }
+}
+
 int main(int argc, char* argv[]) {
     double max_time = 0;
 
     if ( argc <= 1 ) {
         std::cerr << "usage: " << argv[0] << " -n <text> <patterns>\n";
         std::cerr << "       " << "Prints the number of patterns that match the text.\n";
+        std::cerr << "       " << argv[0] << " -q <limit> <text> <patterns>\n";
+        std::cerr << "       " << "Prints the results of every kind of query.\n";
+        std::cerr << "       " << argv[0] << " -u <limit> <text> <patterns>\n";
+        std::cerr << "       " << "Same, but queries the patterns before compiling them.\n";
+        std::cerr << "       " << argv[0] << " -r <limit> <text> <patterns>\n";
+        std::cerr << "       " << "Same, but compiles the patterns twice.\n";
+        std::cerr << "       " << argv[0] << " -x <options> <limit> <text> <patterns>\n";
+        std::cerr << "       " << "Same, but compiles the patterns with a comma separated list of options.\n";
+        std::cerr << "       " << argv[0] << " -y <options> <limit> <text> <patterns>\n";
+        std::cerr << "       " << "Same, but loads the serialization with the options.\n";
+        std::cerr << "       " << argv[0] << " -k <limit> <text> <patterns>\n";
+        std::cerr << "       " << "Same, for the patterns, every other one and all again, sharing one context.\n";
+        std::cerr << "       " << argv[0] << " -p <text> <patterns>\n";
+        std::cerr << "       " << "Prints the matches with their ids and payloads, before and after serializing.\n";
+        std::cerr << "       " << argv[0] << " -o <text> <patterns>\n";
+        std::cerr << "       " << "Same, for patterns loaded from the unversioned format.\n";
+        std::cerr << "       " << argv[0] << " -c <patterns>\n";
+        std::cerr << "       " << "Prints the errors of loading corrupted serializations.\n";
         std::cerr << "       " << argv[0] << " -b <a> <b> <c> <time>\n";
         std::cerr << "       " << "Benchmark. a - n patterns. b - n queries. c - % matches.\n";
+        std::cerr << "       " << argv[0] << " -l <a> <b> <length>\n";
+        std::cerr << "       " << "Benchmark long texts. a - n patterns. b - n queries.\n";
+        std::cerr << "       " << "Compares the skip scanner to the automaton, also for 100000 patterns.\n";
         std::cerr << "       " << argv[0] << " -s <patterns>\n";
         std::cerr << "       " << "Prints a a paraglob with **patterns** serialization\n";
         exit(1);
@@ -61,15 +216,80 @@ int main(int argc, char* argv[]) {
             }
         }
     }
+    else if ( strcmp(argv[1], "-l") == 0 ) {
+        benchmark_long(atol(argv[2]), atol(argv[3]), atol(argv[4]), false);
+    }
     else if ( strcmp(argv[1], "-n") == 0 ) {
         std::vector<std::string> v;
         for ( int i = 3; i < argc; i++ ) {
             v.push_back(std::string(argv[i]));
         }
         paraglob::Paraglob p(v);
-        std::cout << p.get(std::string(argv[2])).size() << "\n";
+        std::cout << p.count(std::string(argv[2])) << "\n";
         std::cout << p.str();
     }
+    else if ( strcmp(argv[1], "-q") == 0 ) {
+        std::vector<std::string> v;
+        for ( int i = 4; i < argc; i++ ) {
+            v.push_back(std::string(argv[i]));
+        }
+        paraglob::Paraglob p(v);
+        print_queries(p, argv[3], atol(argv[2]));
+    }
+    else if ( strcmp(argv[1], "-u") == 0 ) {
+        paraglob::Paraglob p;
+        for ( int i = 4; i < argc; i++ ) {
+            p.add(std::string(argv[i]));
+        }
+        print_queries(p, argv[3], atol(argv[2]));
+    }
+    else if ( strcmp(argv[1], "-r") == 0 ) {
+        paraglob::Paraglob p;
+        for ( int i = 4; i < argc; i++ ) {
+            p.add(std::string(argv[i]));
+        }
+        p.compile();
+        p.compile();
+        print_queries(p, argv[3], atol(argv[2]));
+    }
+    else if ( strcmp(argv[1], "-x") == 0 ) {
+        std::vector<std::string> samples;
+        paraglob::CompileOptions options = parse_options(argv[2], samples);
+
+        std::vector<std::string> v;
+        for ( int i = 5; i < argc; i++ ) {
+            v.push_back(std::string(argv[i]));
+        }
+        paraglob::Paraglob p(v, options);
+        print_queries(p, argv[4], atol(argv[3]));
+    }
+    else if ( strcmp(argv[1], "-y") == 0 ) {
+        std::vector<std::string> samples;
+        paraglob::CompileOptions options = parse_options(argv[2], samples);
+
+        std::vector<std::string> v;
+        for ( int i = 5; i < argc; i++ ) {
+            v.push_back(std::string(argv[i]));
+        }
+        paraglob::Paraglob sp(paraglob::Paraglob(v).serialize(), options);
+        print_queries(sp, argv[4], atol(argv[3]));
+    }
+    else if ( strcmp(argv[1], "-k") == 0 ) {
+        std::vector<std::string> v;
+        std::vector<std::string> every_other;
+        for ( int i = 4; i < argc; i++ ) {
+            v.push_back(std::string(argv[i]));
+            if ( i % 2 == 0 )
+                every_other.push_back(std::string(argv[i]));
+        }
+        paraglob::Paraglob p(v);
+        paraglob::Paraglob q(every_other);
+
+        paraglob::QueryContext context;
+        print_queries(p, argv[3], atol(argv[2]), &context);
+        print_queries(q, argv[3], atol(argv[2]), &context);
+        print_queries(p, argv[3], atol(argv[2]), &context);
+    }
     else if ( strcmp(argv[1], "-s") == 0 ) {
         std::vector<std::string> v;
         for ( int i = 3; i < argc; i++ ) {
@@ -86,6 +306,58 @@ int main(int argc, char* argv[]) {
             std::cerr << e.what() << '\n';
         }
     }
+    else if ( strcmp(argv[1], "-p") == 0 ) {
+        paraglob::Paraglob p;
+        for ( int i = 3; i < argc; i++ ) {
+            p.add(std::string(argv[i]), (i - 2) * 100);
+        }
+        p.compile();
+        std::cout << "before:\n";
+        print_matches(p, argv[2]);
+
+        paraglob::Paraglob sp(p.serialize());
+        std::cout << "after:\n";
+        print_matches(sp, argv[2]);
+    }
+    else if ( strcmp(argv[1], "-o") == 0 ) {
+        // <n_strings><len_1><str_1> ... <len_n><str_n>
+        std::vector<uint8_t> data;
+        append_int(data, argc - 3);
+        for ( int i = 3; i < argc; i++ ) {
+            append_int(data, strlen(argv[i]));
+            data.insert(data.end(), argv[i], argv[i] + strlen(argv[i]));
+        }
+
+        paraglob::Paraglob p(std::make_unique<std::vector<uint8_t>>(data));
+        print_matches(p, argv[2]);
+    }
+    else if ( strcmp(argv[1], "-c") == 0 ) {
+        std::vector<std::string> v;
+        for ( int i = 2; i < argc; i++ ) {
+            v.push_back(std::string(argv[i]));
+        }
+        std::vector<uint8_t> data = *paraglob::Paraglob(v).serialize();
+
+        std::vector<uint8_t> truncated(data.begin(), data.end() - 1);
+        print_load_error("truncated", truncated);
+
+        std::vector<uint8_t> header(data.begin(), data.begin() + 12);
+        print_load_error("header", header);
+
+        // The version follows the magic number.
+        std::vector<uint8_t> version = data;
+        version[8] = 99;
+        print_load_error("version", version);
+
+        // The number of patterns follows the version.
+        std::vector<uint8_t> more = data;
+        more[16] += 1;
+        print_load_error("count + 1", more);
+
+        std::vector<uint8_t> fewer = data;
+        fewer[16] -= 1;
+        print_load_error("count - 1", fewer);
+    }
     else if ( strcmp(argv[1], "-str") == 0 ) {
         std::vector<std::string> v;
         for ( int i = 3; i < argc; i++ ) {